@@ -0,0 +1,784 @@
+/*
+
+Copyright (c) 2009, Takashi Michikawa
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of RCAST, The University of Tokyo nor the names of its
+contributors may be used to endorse or promote products derived from
+this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/**
+* @file brick_octree.hpp
+* @brief
+* "brick_octree" is an octree whose nodes stop at a fixed level and
+* store dense bricks (e.g. 8x8x8 values) instead of splitting down to
+* single voxels. Bricks are scanned with SSE2/AVX2 kernels for int32_t and
+* float values.
+*
+* @note This code is distributed under BSD license.
+*/
+#ifndef __BRICK_OCTREE_HPP__
+#define __BRICK_OCTREE_HPP__ 1
+#include "octree.hpp"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace mi
+{
+        /**
+        * @struct brick_kernels
+        * @brief Kernels over contiguous values of a brick.
+        *
+        * The generic version is plain loops. int32_t and float are specialized
+        * with SSE2 or AVX2 intrinsics when the compiler targets them.
+        */
+        template < typename T >
+        struct brick_kernels {
+                /**
+                * @brief set v to p[0], ..., p[n-1].
+                */
+                static void fill ( T* p, const size_t n, const T& v ) {
+                        for ( size_t i = 0 ; i < n ; ++i ) p[i] = v;
+                        return;
+                }
+
+                /**
+                * @retval true p[0], ..., p[n-1] are all equal to v.
+                */
+                static bool all_equal ( const T* p, const size_t n, const T& v ) {
+                        for ( size_t i = 0 ; i < n ; ++i ) {
+                                if ( !( p[i] == v ) ) return false;
+                        }
+                        return true;
+                }
+
+                /**
+                * @return the number of values equal to v.
+                */
+                static size_t count ( const T* p, const size_t n, const T& v ) {
+                        size_t c = 0;
+                        for ( size_t i = 0 ; i < n ; ++i ) {
+                                if ( p[i] == v ) ++c;
+                        }
+                        return c;
+                }
+
+                /**
+                * @brief get the range of p[0], ..., p[n-1] (n > 0).
+                */
+                static void min_max ( const T* p, const size_t n, T& mn, T& mx ) {
+                        mn = mx = p[0];
+                        for ( size_t i = 1 ; i < n ; ++i ) {
+                                if ( p[i] < mn ) mn = p[i];
+                                if ( mx < p[i] ) mx = p[i];
+                        }
+                        return;
+                }
+        };
+
+#if defined(__AVX2__) || defined(__SSE2__)
+        template <>
+        struct brick_kernels<int32_t> {
+#if defined(__AVX2__)
+                typedef __m256i vec;
+                static int const WIDTH = 8;
+                static vec load ( const int32_t* p ) { return _mm256_loadu_si256( reinterpret_cast<const vec*>( p ) ); }
+                static void store ( int32_t* p, const vec v ) { _mm256_storeu_si256( reinterpret_cast<vec*>( p ), v ); }
+                static vec splat ( const int32_t v ) { return _mm256_set1_epi32( v ); }
+                static vec equal ( const vec a, const vec b ) { return _mm256_cmpeq_epi32( a, b ); }
+                static vec bit_or ( const vec a, const vec b ) { return _mm256_or_si256( a, b ); }
+                static vec bit_xor ( const vec a, const vec b ) { return _mm256_xor_si256( a, b ); }
+                static vec sub ( const vec a, const vec b ) { return _mm256_sub_epi32( a, b ); }
+                static vec min ( const vec a, const vec b ) { return _mm256_min_epi32( a, b ); }
+                static vec max ( const vec a, const vec b ) { return _mm256_max_epi32( a, b ); }
+                static bool is_zero ( const vec a ) { return _mm256_testz_si256( a, a ) != 0; }
+#else
+                typedef __m128i vec;
+                static int const WIDTH = 4;
+                static vec load ( const int32_t* p ) { return _mm_loadu_si128( reinterpret_cast<const vec*>( p ) ); }
+                static void store ( int32_t* p, const vec v ) { _mm_storeu_si128( reinterpret_cast<vec*>( p ), v ); }
+                static vec splat ( const int32_t v ) { return _mm_set1_epi32( v ); }
+                static vec equal ( const vec a, const vec b ) { return _mm_cmpeq_epi32( a, b ); }
+                static vec bit_or ( const vec a, const vec b ) { return _mm_or_si128( a, b ); }
+                static vec bit_xor ( const vec a, const vec b ) { return _mm_xor_si128( a, b ); }
+                static vec sub ( const vec a, const vec b ) { return _mm_sub_epi32( a, b ); }
+                static vec min ( const vec a, const vec b ) { // SSE2 has no _mm_min_epi32.
+                        const vec lt = _mm_cmplt_epi32( a, b );
+                        return _mm_or_si128( _mm_and_si128( lt, a ), _mm_andnot_si128( lt, b ) );
+                }
+                static vec max ( const vec a, const vec b ) {
+                        const vec gt = _mm_cmpgt_epi32( a, b );
+                        return _mm_or_si128( _mm_and_si128( gt, a ), _mm_andnot_si128( gt, b ) );
+                }
+                static bool is_zero ( const vec a ) { return _mm_movemask_epi8( _mm_cmpeq_epi32( a, _mm_setzero_si128() ) ) == 0xFFFF; }
+#endif
+                static void fill ( int32_t* p, const size_t n, const int32_t& v ) {
+                        const vec vv = splat( v );
+                        size_t i = 0;
+                        for ( ; i < n - n % WIDTH ; i += WIDTH ) store( p + i, vv );
+                        for ( ; i < n ; ++i ) p[i] = v;
+                        return;
+                }
+
+                static bool all_equal ( const int32_t* p, const size_t n, const int32_t& v ) {
+                        const vec vv = splat( v );
+                        vec diff = splat( 0 );
+                        size_t i = 0;
+                        for ( ; i < n - n % WIDTH ; i += WIDTH ) diff = bit_or( diff, bit_xor( load( p + i ), vv ) );
+                        for ( ; i < n ; ++i ) {
+                                if ( p[i] != v ) return false;
+                        }
+                        return is_zero( diff );
+                }
+
+                static size_t count ( const int32_t* p, const size_t n, const int32_t& v ) {
+                        const vec vv = splat( v );
+                        vec c = splat( 0 );
+                        size_t i = 0;
+                        for ( ; i < n - n % WIDTH ; i += WIDTH ) c = sub( c, equal( load( p + i ), vv ) ); // equal lanes are -1.
+                        int32_t lanes[WIDTH];
+                        store( lanes, c );
+                        size_t result = 0;
+                        for ( int k = 0 ; k < WIDTH ; ++k ) result += static_cast<uint32_t>( lanes[k] );
+                        for ( ; i < n ; ++i ) {
+                                if ( p[i] == v ) ++result;
+                        }
+                        return result;
+                }
+
+                static void min_max ( const int32_t* p, const size_t n, int32_t& mn, int32_t& mx ) {
+                        size_t i = 0;
+                        mn = mx = p[0];
+                        if ( n >= static_cast<size_t>( WIDTH ) ) {
+                                vec vmn = load( p );
+                                vec vmx = vmn;
+                                for ( i = WIDTH ; i < n - n % WIDTH ; i += WIDTH ) {
+                                        const vec x = load( p + i );
+                                        vmn = min( vmn, x );
+                                        vmx = max( vmx, x );
+                                }
+                                int32_t lmn[WIDTH], lmx[WIDTH];
+                                store( lmn, vmn );
+                                store( lmx, vmx );
+                                for ( int k = 0 ; k < WIDTH ; ++k ) {
+                                        if ( lmn[k] < mn ) mn = lmn[k];
+                                        if ( mx < lmx[k] ) mx = lmx[k];
+                                }
+                        }
+                        for ( ; i < n ; ++i ) {
+                                if ( p[i] < mn ) mn = p[i];
+                                if ( mx < p[i] ) mx = p[i];
+                        }
+                        return;
+                }
+        };
+
+        template <>
+        struct brick_kernels<float> {
+#if defined(__AVX2__)
+                typedef __m256 vec;
+                static int const WIDTH = 8;
+                static vec load ( const float* p ) { return _mm256_loadu_ps( p ); }
+                static void store ( float* p, const vec v ) { _mm256_storeu_ps( p, v ); }
+                static vec splat ( const float v ) { return _mm256_set1_ps( v ); }
+                static vec equal ( const vec a, const vec b ) { return _mm256_cmp_ps( a, b, _CMP_EQ_OQ ); }
+                static vec bit_and ( const vec a, const vec b ) { return _mm256_and_ps( a, b ); }
+                static vec min ( const vec a, const vec b ) { return _mm256_min_ps( a, b ); }
+                static vec max ( const vec a, const vec b ) { return _mm256_max_ps( a, b ); }
+                static int mask ( const vec a ) { return _mm256_movemask_ps( a ); }
+                static int const ALL = 0xFF;
+#else
+                typedef __m128 vec;
+                static int const WIDTH = 4;
+                static vec load ( const float* p ) { return _mm_loadu_ps( p ); }
+                static void store ( float* p, const vec v ) { _mm_storeu_ps( p, v ); }
+                static vec splat ( const float v ) { return _mm_set1_ps( v ); }
+                static vec equal ( const vec a, const vec b ) { return _mm_cmpeq_ps( a, b ); }
+                static vec bit_and ( const vec a, const vec b ) { return _mm_and_ps( a, b ); }
+                static vec min ( const vec a, const vec b ) { return _mm_min_ps( a, b ); }
+                static vec max ( const vec a, const vec b ) { return _mm_max_ps( a, b ); }
+                static int mask ( const vec a ) { return _mm_movemask_ps( a ); }
+                static int const ALL = 0x0F;
+#endif
+                static void fill ( float* p, const size_t n, const float& v ) {
+                        const vec vv = splat( v );
+                        size_t i = 0;
+                        for ( ; i < n - n % WIDTH ; i += WIDTH ) store( p + i, vv );
+                        for ( ; i < n ; ++i ) p[i] = v;
+                        return;
+                }
+
+                static bool all_equal ( const float* p, const size_t n, const float& v ) {
+                        const vec vv = splat( v );
+                        vec same = equal( vv, vv );
+                        size_t i = 0;
+                        for ( ; i < n - n % WIDTH ; i += WIDTH ) same = bit_and( same, equal( load( p + i ), vv ) );
+                        for ( ; i < n ; ++i ) {
+                                if ( !( p[i] == v ) ) return false;
+                        }
+                        return mask( same ) == ALL;
+                }
+
+                static size_t count ( const float* p, const size_t n, const float& v ) {
+                        const vec vv = splat( v );
+                        size_t result = 0;
+                        size_t i = 0;
+                        for ( ; i < n - n % WIDTH ; i += WIDTH ) {
+                                const int m = mask( equal( load( p + i ), vv ) );
+                                for ( int k = 0 ; k < WIDTH ; ++k ) result += ( m >> k ) & 1;
+                        }
+                        for ( ; i < n ; ++i ) {
+                                if ( p[i] == v ) ++result;
+                        }
+                        return result;
+                }
+
+                static void min_max ( const float* p, const size_t n, float& mn, float& mx ) {
+                        size_t i = 0;
+                        mn = mx = p[0];
+                        if ( n >= static_cast<size_t>( WIDTH ) ) {
+                                vec vmn = load( p );
+                                vec vmx = vmn;
+                                for ( i = WIDTH ; i < n - n % WIDTH ; i += WIDTH ) {
+                                        const vec x = load( p + i );
+                                        vmn = min( vmn, x );
+                                        vmx = max( vmx, x );
+                                }
+                                float lmn[WIDTH], lmx[WIDTH];
+                                store( lmn, vmn );
+                                store( lmx, vmx );
+                                for ( int k = 0 ; k < WIDTH ; ++k ) {
+                                        if ( lmn[k] < mn ) mn = lmn[k];
+                                        if ( mx < lmx[k] ) mx = lmx[k];
+                                }
+                        }
+                        for ( ; i < n ; ++i ) {
+                                if ( p[i] < mn ) mn = p[i];
+                                if ( mx < p[i] ) mx = p[i];
+                        }
+                        return;
+                }
+        };
+#endif
+
+        /**
+        * @class brick_octree
+        * brick_octree stores dense bricks of 2^BrickLevel x 2^BrickLevel x 2^BrickLevel
+        * values at level BrickLevel. Above that level it is a usual octree, and a brick
+        * whose values become uniform collapses back to a single leaf.
+        * @section ex Example code
+        * @code
+        * mi::brick_octree<int> tree(1024, 0); // 8x8x8 bricks
+        * tree.set(100, 200, 300, 4);
+        * int value = tree.get(100, 200, 300); // value = 4;
+        * size_t n = tree.count_nonempty(); // n = 1;
+        * @endcode
+        * @note The dimension is at least the brick size.
+        */
+        template < typename T, template < typename > class Allocator = new_allocator, unsigned char BrickLevel = 3 >
+        class brick_octree
+        {
+        public:
+                static int const BRICK_SIZE = 1 << BrickLevel; ///< Edge length of a brick.
+                static size_t const BRICK_VOXELS = size_t(1) << ( 3 * BrickLevel ); ///< The number of values in a brick.
+                static unsigned char const MAX_LEVEL = 21; ///< 8^21 voxels fit in a 64-bit size_t.
+        private:
+                struct block;
+                struct alignas(16) brick {
+                        T voxel[BRICK_VOXELS]; ///< voxel[x + BRICK_SIZE * ( y + BRICK_SIZE * z )]
+                };
+                typedef Allocator<block> block_allocator;
+                typedef Allocator<brick> brick_allocator;
+                typedef typename block_allocator::handle handle;
+                typedef brick_kernels<T> kernels;
+
+                static handle const INTERMEDIATE_BIT = 0x01; ///< _child holds a block of 8 children.
+                static handle const BRICK_BIT = 0x02;        ///< _child holds a brick.
+                static handle const TAG_MASK = 0x03;
+
+                /**
+                * @brief a node is a leaf (_child == 0), an intermediate node or a brick.
+                */
+                struct node {
+                        handle _child; ///< Handle of the children or the brick with a tag.
+                        T _value;      ///< Value of a leaf.
+                        node ( void ) : _child(0), _value() {
+                                return;
+                        }
+                        bool is_leaf ( void ) const {
+                                return this->_child == 0;
+                        }
+                        bool is_intermediate ( void ) const {
+                                return ( this->_child & INTERMEDIATE_BIT ) != 0;
+                        }
+                        bool is_brick ( void ) const {
+                                return ( this->_child & BRICK_BIT ) != 0;
+                        }
+                };
+
+                struct block {
+                        node child[8];
+                };
+
+                unsigned char   _level;      ///< Maximum level of the octree.
+                int             _dimension;  ///< Size of the octree.
+                T               _emptyValue; ///< Empty value of the octree.
+                node            _root;       ///< Root node.
+                block_allocator _blocks;     ///< Allocator of intermediate nodes.
+                brick_allocator _bricks;     ///< Allocator of bricks.
+        private:
+                brick_octree ( const brick_octree& that );
+                void operator = ( const brick_octree& that );
+        public:
+                /**
+                * @param[in] dimension dimension of the octree
+                * @param[in] emptyValue the default value of the octree
+                */
+                brick_octree ( const int dimension = BRICK_SIZE, const T emptyValue = T() ) : _level(BrickLevel), _dimension(BRICK_SIZE), _emptyValue(emptyValue) {
+                        static_assert( BrickLevel >= 1 && BrickLevel <= 6, "a brick must be 2^3 to 64^3 values" );
+                        static_assert( std::is_same<handle, typename brick_allocator::handle>::value, "blocks and bricks must share the handle type" );
+                        this->init( dimension, emptyValue );
+                        return;
+                }
+
+                /**
+                * @brief Destructor
+                */
+                ~brick_octree ( void ) {
+                        this->release();
+                        return;
+                }
+
+                /**
+                * @param[in] dimension dimension of the octree
+                * @param[in] emptyValue the default value of the octree
+                * @note The dimension is clamped to 2^MAX_LEVEL.
+                */
+                void init ( const int dimension, const T emptyValue ) {
+                        this->release();
+                        this->_level = BrickLevel;
+                        while ( this->_level < MAX_LEVEL && ( 1 << this->_level ) < dimension ) ++this->_level;
+                        this->_dimension  = 1 << this->_level;
+                        this->_emptyValue = emptyValue;
+                        this->_root._value = emptyValue;
+                        return;
+                }
+
+                /**
+                * @brief get value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                */
+                T get ( const int x, const int y, const int z ) const {
+                        if ( !this->is_valid(x, y, z) ) return this->_emptyValue;
+                        const node* nd = &(this->_root);
+                        unsigned char l = this->_level;
+                        while ( nd->is_intermediate() ) {
+                                --l;
+                                nd = this->children( *nd ) + child_index( x, y, z, l );
+                        }
+                        if ( nd->is_brick() ) return this->get_brick( *nd )->voxel[ brick_index( x, y, z ) ];
+                        return nd->_value;
+                }
+
+                /**
+                * @brief set value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[in] v value
+                * @note do nothing if (x,y,z) is invalid.
+                */
+                void set ( const int x, const int y, const int z, const T v ) {
+                        if ( !this->is_valid(x, y, z) ) return;
+                        node* nd = &(this->_root);
+                        for ( unsigned char l = this->_level ; l > BrickLevel ; --l ) {
+                                if ( nd->is_leaf() ) {
+                                        if ( nd->_value == v ) return;
+                                        this->create_child( *nd );
+                                }
+                                nd = this->children( *nd ) + child_index( x, y, z, l - 1 );
+                        }
+                        if ( !nd->is_brick() ) {
+                                if ( nd->_value == v ) return;
+                                this->create_brick( *nd );
+                        }
+                        brick* b = this->get_brick( *nd );
+                        b->voxel[ brick_index( x, y, z ) ] = v;
+                        if ( b->voxel[0] == v && b->voxel[BRICK_VOXELS - 1] == v && kernels::all_equal( b->voxel, BRICK_VOXELS, v ) ) {
+                                this->remove_brick( *nd );
+                        }
+                        return;
+                }
+
+                /**
+                * @brief set value to all voxels in the box (mnx, mny, mnz) - (mxx, mxy, mxz)
+                * @param[in] mnx minimum x-coordinate
+                * @param[in] mny minimum y-coordinate
+                * @param[in] mnz minimum z-coordinate
+                * @param[in] mxx maximum x-coordinate
+                * @param[in] mxy maximum y-coordinate
+                * @param[in] mxz maximum z-coordinate
+                * @param[in] v value
+                * @note The box is clipped by the octree.
+                */
+                void fill_box ( const int mnx, const int mny, const int mnz, const int mxx, const int mxy, const int mxz, const T v ) {
+                        const int box[6] = { mnx, mny, mnz, mxx, mxy, mxz };
+                        this->fill_node( this->_root, this->_level, 0, 0, 0, box, v );
+                        return;
+                }
+
+                /**
+                * @brief check (x, y, z) is valid
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is valid
+                * @retval false (x, y, z) is invalid
+                */
+                bool is_valid ( const int x, const int y, const int z ) const {
+                        if ( x < 0 || y < 0 || z < 0 ) return false;
+                        if ( this->_dimension <= x || this->_dimension <= y || this->_dimension <= z ) return false;
+                        return true;
+                }
+
+                /**
+                * @param[in] value value to count
+                * @return the number of voxels with the value.
+                */
+                size_t count ( const T& value ) const {
+                        return this->count_node( this->_root, this->_level, value );
+                }
+
+                /**
+                * @return the number of voxels which are not empty.
+                * @note The total of 8^MAX_LEVEL voxels fits in a 64-bit size_t.
+                */
+                size_t count_nonempty ( void ) const {
+                        return ( size_t(1) << ( 3 * this->_level ) ) - this->count( this->_emptyValue );
+                }
+
+                /**
+                * @param[out] mn minimum value in the octree
+                * @param[out] mx maximum value in the octree
+                * @note T must support operator<.
+                */
+                void value_range ( T& mn, T& mx ) const {
+                        this->value_range( this->_root, mn, mx );
+                        return;
+                }
+
+                /**
+                * @brief call func for every leaf and every voxel of bricks.
+                * @param[in] func called as func(x, y, z, size, value) for the cube (x, y, z) - (x + size - 1, y + size - 1, z + size - 1).
+                * @param[in] skipEmpty skip voxels with the empty value or not
+                */
+                template < typename Function >
+                void for_each_leaf ( Function func, const bool skipEmpty = false ) const {
+                        this->for_each_node( this->_root, this->_level, 0, 0, 0, func, skipEmpty );
+                        return;
+                }
+
+                /**
+                * @brief collapse uniform bricks and merge intermediate nodes whose 8 children are leaves with the same value.
+                * @return the number of freed blocks and bricks.
+                */
+                size_t optimize ( void ) {
+                        return this->optimize_node( this->_root );
+                }
+
+                /**
+                * @brief copy an octree.
+                * @param[in] tree the octree
+                */
+                template < template < typename > class A, typename S >
+                void copy_from ( const octree<T, A, S>& tree ) {
+                        this->init( tree.getDimension(), tree.getEmptyValue() );
+                        const int d = tree.getDimension() - 1;
+                        tree.for_each_in_box( 0, 0, 0, d, d, d, [this] ( int x, int y, int z, int size, const T& value ) {
+                                if ( value != this->_emptyValue ) this->fill_box( x, y, z, x + size - 1, y + size - 1, z + size - 1, value );
+                        } );
+                        return;
+                }
+
+                /**
+                * @brief copy to an octree.
+                * @param[out] tree the octree. It is initialized with the same dimension and empty value.
+                */
+                template < template < typename > class A, typename S >
+                void copy_to ( octree<T, A, S>& tree ) const {
+                        tree.init( this->_dimension, this->_emptyValue );
+                        this->for_each_leaf( [&tree] ( int x, int y, int z, int size, const T& value ) {
+                                if ( size == 1 ) tree.set( x, y, z, value );
+                                else tree.fill_box( x, y, z, x + size - 1, y + size - 1, z + size - 1, value );
+                        }, true );
+                        tree.optimize();
+                        return;
+                }
+
+                /**
+                * @return a dimension of the octree. It must be a 2^n.
+                */
+                int getDimension ( void ) const {
+                        return this->_dimension;
+                }
+
+                /**
+                * @return empty value of the octree.
+                */
+                T getEmptyValue ( void ) const {
+                        return this->_emptyValue;
+                }
+
+                /**
+                * @return the number of live bricks.
+                */
+                size_t bricks ( void ) const {
+                        return this->_bricks.live_blocks();
+                }
+
+                /**
+                * @return bytes used by the root, intermediate nodes and bricks.
+                */
+                size_t bytes_used ( void ) const {
+                        return sizeof(*this) + this->_blocks.reserved_bytes() + this->_bricks.reserved_bytes();
+                }
+        private:
+                static int child_index ( const int x, const int y, const int z, const unsigned char level ) {
+                        return ( ( x >> level ) & 1 ) | ( ( ( y >> level ) & 1 ) << 1 ) | ( ( ( z >> level ) & 1 ) << 2 );
+                }
+
+                static size_t brick_index ( const int x, const int y, const int z ) {
+                        const int m = BRICK_SIZE - 1;
+                        return static_cast<size_t>( ( x & m ) + BRICK_SIZE * ( ( y & m ) + BRICK_SIZE * ( z & m ) ) );
+                }
+
+                node* children ( const node& nd ) const {
+                        return this->_blocks.resolve( nd._child & ~TAG_MASK )->child;
+                }
+
+                brick* get_brick ( const node& nd ) const {
+                        return this->_bricks.resolve( nd._child & ~TAG_MASK );
+                }
+
+                /**
+                * @brief split a leaf into 8 leaves with its value.
+                */
+                void create_child ( node& nd ) {
+                        const handle h = this->_blocks.allocate();
+                        node* child = this->_blocks.resolve( h )->child;
+                        for ( int i = 0 ; i < 8 ; ++i ) child[i]._value = nd._value;
+                        nd._child = h | INTERMEDIATE_BIT;
+                        return;
+                }
+
+                /**
+                * @brief turn a leaf at BrickLevel into a brick filled with its value.
+                */
+                void create_brick ( node& nd ) {
+                        const handle h = this->_bricks.allocate();
+                        kernels::fill( this->_bricks.resolve( h )->voxel, BRICK_VOXELS, nd._value );
+                        nd._child = h | BRICK_BIT;
+                        return;
+                }
+
+                /**
+                * @brief turn a uniform brick into a leaf.
+                */
+                void remove_brick ( node& nd ) {
+                        nd._value = this->get_brick( nd )->voxel[0];
+                        this->_bricks.deallocate( nd._child & ~TAG_MASK );
+                        nd._child = 0;
+                        return;
+                }
+
+                /**
+                * @brief free the children or the brick of a node. The node becomes a leaf.
+                * @return the number of freed blocks and bricks.
+                */
+                size_t remove_children ( node& nd ) {
+                        size_t count = 0;
+                        if ( nd.is_brick() ) {
+                                this->_bricks.deallocate( nd._child & ~TAG_MASK );
+                                count = 1;
+                        } else if ( nd.is_intermediate() ) {
+                                node* child = this->children( nd );
+                                for ( int i = 0 ; i < 8 ; ++i ) count += this->remove_children( child[i] );
+                                this->_blocks.deallocate( nd._child & ~TAG_MASK );
+                                ++count;
+                        }
+                        nd._child = 0;
+                        return count;
+                }
+
+                /**
+                * @brief merge 8 children if they are leaves with the same value.
+                * @return the number of freed blocks.
+                */
+                size_t merge_uniform ( node& nd ) {
+                        const node* child = this->children( nd );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                if ( !child[i].is_leaf() || !( child[i]._value == child[0]._value ) ) return 0;
+                        }
+                        nd._value = child[0]._value;
+                        this->_blocks.deallocate( nd._child & ~TAG_MASK );
+                        nd._child = 0;
+                        return 1;
+                }
+
+                void release ( void ) {
+                        if ( !block_allocator::bulk_release || !brick_allocator::bulk_release || !std::is_trivially_destructible<T>::value ) {
+                                this->remove_children( this->_root );
+                        }
+                        this->_root._child = 0;
+                        this->_blocks.clear();
+                        this->_bricks.clear();
+                        return;
+                }
+
+                /**
+                * @return 0 : outside, 1 : partially inside, 2 : inside the box
+                */
+                static int overlap ( const int ox, const int oy, const int oz, const int d, const int* box ) {
+                        if ( ox + d - 1 < box[0] || oy + d - 1 < box[1] || oz + d - 1 < box[2] ) return 0;
+                        if ( box[3] < ox || box[4] < oy || box[5] < oz ) return 0;
+                        if ( box[0] <= ox && box[1] <= oy && box[2] <= oz &&
+                             ox + d - 1 <= box[3] && oy + d - 1 <= box[4] && oz + d - 1 <= box[5] ) return 2;
+                        return 1;
+                }
+
+                void fill_node ( node& nd, const unsigned char level, const int ox, const int oy, const int oz, const int* box, const T& v ) {
+                        const int d = 1 << level;
+                        const int state = overlap( ox, oy, oz, d, box );
+                        if ( state == 0 ) return;
+                        if ( state == 2 ) {
+                                this->remove_children( nd );
+                                nd._value = v;
+                                return;
+                        }
+                        if ( level == BrickLevel ) {
+                                if ( !nd.is_brick() ) {
+                                        if ( nd._value == v ) return;
+                                        this->create_brick( nd );
+                                }
+                                brick* b = this->get_brick( nd );
+                                const int x0 = std::max( box[0], ox ), x1 = std::min( box[3], ox + d - 1 );
+                                const int y0 = std::max( box[1], oy ), y1 = std::min( box[4], oy + d - 1 );
+                                const int z0 = std::max( box[2], oz ), z1 = std::min( box[5], oz + d - 1 );
+                                for ( int z = z0 ; z <= z1 ; ++z ) {
+                                        for ( int y = y0 ; y <= y1 ; ++y ) {
+                                                kernels::fill( b->voxel + brick_index( x0, y, z ), static_cast<size_t>( x1 - x0 + 1 ), v );
+                                        }
+                                }
+                                if ( kernels::all_equal( b->voxel, BRICK_VOXELS, v ) ) this->remove_brick( nd );
+                                return;
+                        }
+                        if ( nd.is_leaf() ) {
+                                if ( nd._value == v ) return;
+                                this->create_child( nd );
+                        }
+                        node* child = this->children( nd );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->fill_node( child[i], level - 1, ox + d/2 * ( i & 1 ), oy + d/2 * ( ( i >> 1 ) & 1 ), oz + d/2 * ( ( i >> 2 ) & 1 ), box, v );
+                        }
+                        this->merge_uniform( nd );
+                        return;
+                }
+
+                size_t count_node ( const node& nd, const unsigned char level, const T& value ) const {
+                        if ( nd.is_brick() ) return kernels::count( this->get_brick( nd )->voxel, BRICK_VOXELS, value );
+                        if ( nd.is_leaf() ) return ( nd._value == value ) ? ( size_t(1) << ( 3 * level ) ) : 0;
+                        const node* child = this->children( nd );
+                        size_t count = 0;
+                        for ( int i = 0 ; i < 8 ; ++i ) count += this->count_node( child[i], level - 1, value );
+                        return count;
+                }
+
+                void value_range ( const node& nd, T& mn, T& mx ) const {
+                        if ( nd.is_brick() ) {
+                                kernels::min_max( this->get_brick( nd )->voxel, BRICK_VOXELS, mn, mx );
+                                return;
+                        }
+                        if ( nd.is_leaf() ) {
+                                mn = mx = nd._value;
+                                return;
+                        }
+                        const node* child = this->children( nd );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                T cmn, cmx;
+                                this->value_range( child[i], cmn, cmx );
+                                if ( i == 0 || cmn < mn ) mn = cmn;
+                                if ( i == 0 || mx < cmx ) mx = cmx;
+                        }
+                        return;
+                }
+
+                template < typename Function >
+                void for_each_node ( const node& nd, const unsigned char level, const int ox, const int oy, const int oz, Function& func, const bool skipEmpty ) const {
+                        if ( nd.is_brick() ) {
+                                const brick* b = this->get_brick( nd );
+                                for ( int z = 0 ; z < BRICK_SIZE ; ++z ) {
+                                        for ( int y = 0 ; y < BRICK_SIZE ; ++y ) {
+                                                const T* row = b->voxel + BRICK_SIZE * ( y + BRICK_SIZE * z );
+                                                for ( int x = 0 ; x < BRICK_SIZE ; ++x ) {
+                                                        if ( skipEmpty && row[x] == this->_emptyValue ) continue;
+                                                        func( ox + x, oy + y, oz + z, 1, row[x] );
+                                                }
+                                        }
+                                }
+                                return;
+                        }
+                        if ( nd.is_leaf() ) {
+                                if ( !skipEmpty || !( nd._value == this->_emptyValue ) ) func( ox, oy, oz, 1 << level, nd._value );
+                                return;
+                        }
+                        const node* child = this->children( nd );
+                        const int d = 1 << ( level - 1 );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->for_each_node( child[i], level - 1, ox + d * ( i & 1 ), oy + d * ( ( i >> 1 ) & 1 ), oz + d * ( ( i >> 2 ) & 1 ), func, skipEmpty );
+                        }
+                        return;
+                }
+
+                size_t optimize_node ( node& nd ) {
+                        if ( nd.is_leaf() ) return 0;
+                        if ( nd.is_brick() ) {
+                                const brick* b = this->get_brick( nd );
+                                if ( !kernels::all_equal( b->voxel, BRICK_VOXELS, b->voxel[0] ) ) return 0;
+                                this->remove_brick( nd );
+                                return 1;
+                        }
+                        node* child = this->children( nd );
+                        size_t count = 0;
+                        for ( int i = 0 ; i < 8 ; ++i ) count += this->optimize_node( child[i] );
+                        return count + this->merge_uniform( nd );
+                }
+        };
+};
+#endif// __BRICK_OCTREE_HPP__
@@ -0,0 +1,270 @@
+/*
+
+Copyright (c) 2009, Takashi Michikawa
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of RCAST, The University of Tokyo nor the names of its
+contributors may be used to endorse or promote products derived from
+this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/**
+* @file concurrent_octree.hpp
+* @brief
+* "concurrent_octree" is an octree which many threads can set() and get()
+* at the same time. Child blocks are published with compare-and-swap,
+* so a node which is split by several threads at once is allocated only once.
+*
+* @note This code is distributed under BSD license.
+*/
+#ifndef __CONCURRENT_OCTREE_HPP__
+#define __CONCURRENT_OCTREE_HPP__ 1
+#include "octree.hpp"
+#include <atomic>
+#include <type_traits>
+
+namespace mi
+{
+        /**
+        * @class concurrent_octree
+        * concurrent_octree is a thread-safe octree for parallel ingestion.
+        * @section ex Example code
+        * @code
+        * mi::concurrent_octree<int> tree(1024, 0);
+        * // from any number of threads
+        * tree.set(100, 200, 300, 4);
+        * int value = tree.get(100, 200, 300); // value = 4;
+        *
+        * // convert to the compact single-threaded octree when ingestion is done.
+        * mi::octree<int> result;
+        * tree.copy_to(result);
+        * @endcode
+        * @note Leaves are never merged while threads are running.
+        * Concurrent set() at the same voxel is a race (the last write wins).
+        * T must be trivially copyable.
+        */
+        template < typename T >
+        class concurrent_octree
+        {
+        private:
+                struct block;
+
+                /**
+                * @brief a node is a leaf while _child is NULL.
+                */
+                struct node {
+                        std::atomic<block*> _child; ///< Children (published once, never removed while threads run).
+                        std::atomic<T>      _value; ///< Value of a leaf.
+                };
+
+                struct block {
+                        node child[8];
+                        explicit block ( const T value ) {
+                                for ( int i = 0 ; i < 8 ; ++i ) {
+                                        this->child[i]._child.store( NULL, std::memory_order_relaxed );
+                                        this->child[i]._value.store( value, std::memory_order_relaxed );
+                                }
+                                return;
+                        }
+                };
+
+                unsigned char        _level;      ///< Maximum level of the octree.
+                int                  _dimension;  ///< Size of the octree.
+                T                    _emptyValue; ///< Empty value of the octree.
+                node                 _root;       ///< Root node.
+                std::atomic<size_t>  _blocks;     ///< The number of live blocks.
+                std::atomic<size_t>  _collisions; ///< The number of splits lost to another thread.
+        private:
+                concurrent_octree ( const concurrent_octree& that );
+                void operator = ( const concurrent_octree& that );
+        public:
+                /**
+                * @param[in] dimension dimension of the octree
+                * @param[in] emptyValue the default value of the octree
+                */
+                concurrent_octree ( const int dimension = 1, const T emptyValue = T() ) : _level(0), _dimension(1), _emptyValue(emptyValue), _blocks(0), _collisions(0) {
+                        static_assert( std::is_trivially_copyable<T>::value, "concurrent_octree requires a trivially copyable T" );
+                        this->_root._child.store( NULL );
+                        this->init( dimension, emptyValue );
+                        return;
+                }
+
+                /**
+                * @brief Destructor
+                */
+                ~concurrent_octree ( void ) {
+                        this->release( this->_root );
+                        return;
+                }
+
+                /**
+                * @param[in] dimension dimension of the octree
+                * @param[in] emptyValue the default value of the octree
+                * @note Not thread-safe. The dimension is clamped to 2^MAX_LEVEL.
+                */
+                void init ( const int dimension, const T emptyValue ) {
+                        this->release( this->_root );
+                        this->_level = 0;
+                        while ( this->_level < octree<T>::MAX_LEVEL && ( 1 << this->_level ) < dimension ) ++this->_level;
+                        this->_dimension  = 1 << this->_level;
+                        this->_emptyValue = emptyValue;
+                        this->_root._value.store( emptyValue );
+                        this->_collisions.store( 0 );
+                        return;
+                }
+
+                /**
+                * @brief get value at (x, y, z). Thread-safe.
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                */
+                T get ( const int x, const int y, const int z ) const {
+                        if ( !this->is_valid(x, y, z) ) return this->_emptyValue;
+                        const node* nd = &(this->_root);
+                        unsigned char level = this->_level;
+                        for ( const block* b = nd->_child.load( std::memory_order_acquire ) ; b != NULL ; b = nd->_child.load( std::memory_order_acquire ) ) {
+                                --level;
+                                nd = &( b->child[ child_index( x, y, z, level ) ] );
+                        }
+                        return nd->_value.load( std::memory_order_relaxed );
+                }
+
+                /**
+                * @brief set value at (x, y, z). Thread-safe.
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[in] v value
+                * @note do nothing if (x,y,z) is invalid.
+                */
+                void set ( const int x, const int y, const int z, const T v ) {
+                        if ( !this->is_valid(x, y, z) ) return;
+                        node* nd = &(this->_root);
+                        for ( unsigned char level = this->_level ; level > 0 ; --level ) {
+                                block* b = nd->_child.load( std::memory_order_acquire );
+                                if ( b == NULL ) {
+                                        // A leaf above level 0 is never written, so its value is stable.
+                                        const T value = nd->_value.load( std::memory_order_relaxed );
+                                        if ( value == v ) return;
+                                        block* created = new block( value );
+                                        if ( nd->_child.compare_exchange_strong( b, created, std::memory_order_acq_rel, std::memory_order_acquire ) ) {
+                                                b = created;
+                                                ++this->_blocks;
+                                        } else {
+                                                delete created; // b is the block published by another thread.
+                                                ++this->_collisions;
+                                        }
+                                }
+                                nd = &( b->child[ child_index( x, y, z, level - 1 ) ] );
+                        }
+                        nd->_value.store( v, std::memory_order_relaxed );
+                        return;
+                }
+
+                /**
+                * @brief check (x, y, z) is valid
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is valid
+                * @retval false (x, y, z) is invalid
+                */
+                bool is_valid ( const int x, const int y, const int z ) const {
+                        if ( x < 0 || y < 0 || z < 0 ) return false;
+                        if ( this->_dimension <= x || this->_dimension <= y || this->_dimension <= z ) return false;
+                        return true;
+                }
+
+                /**
+                * @brief copy all leaves to an octree. Not thread-safe against set().
+                * @param[out] tree the octree. It is initialized with the same dimension and empty value.
+                */
+                template < template < typename > class Allocator, typename Statistics >
+                void copy_to ( octree<T, Allocator, Statistics>& tree ) const {
+                        tree.init( this->_dimension, this->_emptyValue );
+                        this->copy_node( this->_root, this->_level, 0, 0, 0, tree );
+                        tree.optimize();
+                        return;
+                }
+
+                /**
+                * @return a dimension of the octree. It must be a 2^n.
+                */
+                int getDimension ( void ) const {
+                        return this->_dimension;
+                }
+
+                /**
+                * @return empty value of the octree.
+                */
+                T getEmptyValue ( void ) const {
+                        return this->_emptyValue;
+                }
+
+                /**
+                * @return the number of allocated blocks of 8 children.
+                */
+                size_t blocks ( void ) const {
+                        return this->_blocks.load();
+                }
+
+                /**
+                * @return the number of splits which were lost to another thread and freed.
+                */
+                size_t collisions ( void ) const {
+                        return this->_collisions.load();
+                }
+        private:
+                static int child_index ( const int x, const int y, const int z, const unsigned char level ) {
+                        return ( ( x >> level ) & 1 ) | ( ( ( y >> level ) & 1 ) << 1 ) | ( ( ( z >> level ) & 1 ) << 2 );
+                }
+
+                void release ( node& nd ) {
+                        block* b = nd._child.exchange( NULL );
+                        if ( b == NULL ) return;
+                        for ( int i = 0 ; i < 8 ; ++i ) this->release( b->child[i] );
+                        delete b;
+                        --this->_blocks;
+                        return;
+                }
+
+                template < typename Tree >
+                void copy_node ( const node& nd, const unsigned char level, const int ox, const int oy, const int oz, Tree& tree ) const {
+                        const block* b = nd._child.load( std::memory_order_acquire );
+                        if ( b == NULL ) {
+                                const T value = nd._value.load( std::memory_order_relaxed );
+                                const int d = ( 1 << level ) - 1;
+                                if ( value != this->_emptyValue ) tree.fill_box( ox, oy, oz, ox + d, oy + d, oz + d, value );
+                                return;
+                        }
+                        const int d = 1 << ( level - 1 );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->copy_node( b->child[i], level - 1, ox + d * ( i & 1 ), oy + d * ( ( i >> 1 ) & 1 ), oz + d * ( ( i >> 2 ) & 1 ), tree );
+                        }
+                        return;
+                }
+        };
+};
+#endif// __CONCURRENT_OCTREE_HPP__
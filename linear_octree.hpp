@@ -0,0 +1,379 @@
+/*
+
+Copyright (c) 2009, Takashi Michikawa
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of RCAST, The University of Tokyo nor the names of its
+contributors may be used to endorse or promote products derived from
+this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/**
+* @file linear_octree.hpp
+* @brief
+* "linear_octree" is a read-only octree without pointers. The non-empty
+* leaves are stored as arrays sorted by the Morton code of their first
+* voxel, so a lookup is a binary search over contiguous keys.
+*
+* @note This code is distributed under BSD license.
+*/
+#ifndef __LINEAR_OCTREE_HPP__
+#define __LINEAR_OCTREE_HPP__ 1
+#include "octree.hpp"
+
+namespace mi
+{
+        /**
+        * @class linear_octree
+        * linear_octree is a static copy of an octree built once and then only queried.
+        * @section ex Example code
+        * @code
+        * mi::octree<int> tree(1024, 0);
+        * tree.set(100, 200, 300, 4);
+        *
+        * mi::linear_octree<int> linear(tree);
+        * linear.build_index(4); // optional lookup table over the top 4 levels
+        * int value = linear.get(100, 200, 300); // value = 4;
+        * @endcode
+        * @note Only leaves with a value other than the empty value are stored.
+        * The octree must not be larger than 2^21 (a Morton code fits in 64 bits).
+        */
+        template < typename T >
+        class linear_octree
+        {
+        public:
+                static unsigned char const MAX_LEVEL = morton_code::MAX_LEVEL; ///< 3 * 21 bits fit in a 64-bit Morton code.
+                static unsigned char const MAX_INDEX_LEVEL = 7; ///< The lookup table has at most 8^7 cells.
+        private:
+                std::vector<uint64_t>      _keys;       ///< Morton codes of the first voxels of the leaves (sorted).
+                std::vector<unsigned char> _levels;     ///< Levels of the leaves (the edge length is 2^level).
+                std::vector<T>             _values;     ///< Values of the leaves.
+                std::vector<uint32_t>      _index;      ///< _index[c] : the first leaf at or after the cell c of the lookup table.
+                unsigned char              _indexLevel; ///< The number of levels covered by the lookup table (0 : no table).
+                int                        _dimension;  ///< Size of the octree.
+                unsigned char              _level;      ///< Maximum level of the octree.
+                T                          _emptyValue; ///< Empty value of the octree.
+        private:
+                linear_octree ( const linear_octree& that );
+                void operator = ( const linear_octree& that );
+        public:
+                /**
+                * @brief Default constructor.
+                */
+                linear_octree ( void ) : _indexLevel(0), _dimension(0), _level(0), _emptyValue() {
+                        return;
+                }
+
+                /**
+                * @param[in] tree the octree to copy
+                */
+                template < template < typename > class Allocator, typename Statistics >
+                explicit linear_octree ( const octree<T, Allocator, Statistics>& tree ) : _indexLevel(0), _dimension(0), _level(0), _emptyValue() {
+                        this->build(tree);
+                        return;
+                }
+
+                /**
+                * @brief copy the non-empty leaves of an octree.
+                * @param[in] tree the octree
+                * @retval true Succeeded.
+                * @retval false Failed (the octree is larger than 2^MAX_LEVEL or has too many leaves).
+                */
+                template < template < typename > class Allocator, typename Statistics >
+                bool build ( const octree<T, Allocator, Statistics>& tree ) {
+                        this->clear();
+                        unsigned char level = 0;
+                        while ( level <= MAX_LEVEL && ( 1 << level ) < tree.getDimension() ) ++level;
+                        if ( tree.getDimension() == 0 || level > MAX_LEVEL ) return false;
+                        this->_dimension  = tree.getDimension();
+                        this->_level      = level;
+                        this->_emptyValue = tree.getEmptyValue();
+                        // the leaves are visited in child index order, which is Morton order.
+                        for ( typename octree<T, Allocator, Statistics>::leaf_iterator it = tree.leaf_begin(true) ; it != tree.leaf_end() ; ++it ) {
+                                unsigned char l = 0;
+                                while ( ( 1 << l ) < it->size ) ++l;
+                                this->push( morton_code::encode( it->x, it->y, it->z ), l, it->value );
+                        }
+                        return this->finish();
+                }
+
+                /**
+                * @brief read a file written by octree::write() without building the pointer tree.
+                * @param[in] fin input file stream
+                * @retval true Succeeded.
+                * @retval false Failed.
+                * @note Files in the block format (octree::write_compressed()) are read through an octree.
+                */
+                bool read ( std::ifstream& fin ) {
+                        this->clear();
+                        int dimension;
+                        fin.read( (char*)&dimension, sizeof(int) );
+                        if ( fin.fail() ) return false;
+                        if ( std::memcmp( &dimension, "MIOZ", 4 ) == 0 ) {
+                                fin.seekg( -static_cast<std::streamoff>( sizeof(int) ), std::ios::cur );
+                                octree<T, pool_allocator> tree;
+                                return tree.read(fin) && this->build(tree);
+                        }
+                        T emptyValue;
+                        fin.read( (char*)&emptyValue, sizeof(T) );
+                        if ( fin.fail() || dimension <= 0 ) return false;
+                        unsigned char level = 0;
+                        while ( level <= MAX_LEVEL && ( 1 << level ) < dimension ) ++level;
+                        if ( level > MAX_LEVEL ) return false;
+                        this->_dimension  = 1 << level;
+                        this->_level      = level;
+                        this->_emptyValue = emptyValue;
+                        if ( !this->read_node( fin, level, 0 ) || !this->finish() ) {
+                                this->clear();
+                                return false;
+                        }
+                        return true;
+                }
+
+                /**
+                * @brief build a lookup table of the first leaf in each cell of the top levels.
+                *
+                * A lookup then searches only the leaves of one cell (of edge getDimension() >> levels).
+                * Call it after build() or read(), which remove the table.
+                * @param[in] levels the number of levels (0 : remove the table). It is clipped
+                * to MAX_INDEX_LEVEL and the depth of the octree.
+                */
+                void build_index ( unsigned char levels ) {
+                        if ( levels > MAX_INDEX_LEVEL ) levels = MAX_INDEX_LEVEL;
+                        if ( levels > this->_level ) levels = this->_level;
+                        this->_indexLevel = levels;
+                        this->_index.clear();
+                        if ( levels == 0 ) return;
+                        const size_t cells = size_t(1) << ( 3 * levels );
+                        const unsigned int shift = 3 * ( this->_level - levels );
+                        this->_index.resize( cells + 1 );
+                        size_t i = 0;
+                        for ( size_t c = 0 ; c <= cells ; ++c ) {
+                                while ( i < this->_keys.size() && ( this->_keys[i] >> shift ) < c ) ++i;
+                                this->_index[c] = static_cast<uint32_t>(i);
+                        }
+                        return;
+                }
+
+                /**
+                * @brief release all leaves.
+                */
+                void clear ( void ) {
+                        std::vector<uint64_t>().swap( this->_keys );
+                        std::vector<unsigned char>().swap( this->_levels );
+                        std::vector<T>().swap( this->_values );
+                        std::vector<uint32_t>().swap( this->_index );
+                        this->_indexLevel = 0;
+                        this->_dimension = 0;
+                        this->_level = 0;
+                        return;
+                }
+
+                /**
+                * @brief get value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                */
+                T get ( const int x, const int y, const int z ) const {
+                        if ( !this->is_valid(x, y, z) ) return this->_emptyValue;
+                        const uint64_t key = morton_code::encode(x, y, z);
+                        size_t first = 0;
+                        size_t n = this->_keys.size();
+                        if ( this->_indexLevel != 0 ) {
+                                const size_t c = static_cast<size_t>( key >> ( 3 * ( this->_level - this->_indexLevel ) ) );
+                                first = this->_index[c];
+                                n = this->_index[c + 1] - first;
+                                if ( first > 0 ) { // a larger leaf may start before the cell.
+                                        --first;
+                                        ++n;
+                                }
+                        }
+                        if ( n == 0 ) return this->_emptyValue;
+                        // branchless search of the last key <= key
+                        const uint64_t* base = &(this->_keys[first]);
+                        while ( n > 1 ) {
+                                const size_t half = n / 2;
+                                base = ( base[half] <= key ) ? base + half : base;
+                                n -= half;
+                        }
+                        const size_t i = static_cast<size_t>( base - &(this->_keys[0]) );
+                        if ( key < *base || ( ( key - *base ) >> ( 3 * this->_levels[i] ) ) != 0 ) return this->_emptyValue;
+                        return this->_values[i];
+                }
+
+                /**
+                * @brief check (x, y, z) is valid
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is valid
+                * @retval false (x, y, z) is invalid
+                */
+                bool is_valid ( const int x, const int y, const int z ) const {
+                        if ( x < 0 || y < 0 || z < 0 ) return false;
+                        if ( this->_dimension <= x || this->_dimension <= y || this->_dimension <= z ) return false;
+                        return true;
+                }
+
+                /**
+                * @brief get bounding box (mnx, mny, mnz) - (mxx, mxy, mxz)
+                * @param[out] mnx minimum x-coordinate
+                * @param[out] mny minimum y-coordinate
+                * @param[out] mnz minimum z-coordinate
+                * @param[out] mxx maximum x-coordinate
+                * @param[out] mxy maximum y-coordinate
+                * @param[out] mxz maximum z-coordinate
+                * @param[in] optimized if true, get bounding box of non-empty cells
+                */
+                void boundingbox ( int& mnx, int& mny, int& mnz, int& mxx, int& mxy, int& mxz, bool optimized = true ) const {
+                        if ( !optimized ) {
+                                mnx = mny = mnz = 0;
+                                mxx = mxy = mxz = this->_dimension - 1;
+                                return;
+                        }
+                        mnx = mny = mnz = this->_dimension - 1;
+                        mxx = mxy = mxz = 0;
+                        for ( size_t i = 0 ; i < this->_keys.size() ; ++i ) {
+                                const int x = morton_code::compact_bits( this->_keys[i] );
+                                const int y = morton_code::compact_bits( this->_keys[i] >> 1 );
+                                const int z = morton_code::compact_bits( this->_keys[i] >> 2 );
+                                const int d = ( 1 << this->_levels[i] ) - 1;
+                                if ( x < mnx ) mnx = x;
+                                if ( y < mny ) mny = y;
+                                if ( z < mnz ) mnz = z;
+                                if ( x + d > mxx ) mxx = x + d;
+                                if ( y + d > mxy ) mxy = y + d;
+                                if ( z + d > mxz ) mxz = z + d;
+                        }
+                        return;
+                }
+
+                /**
+                * @param[in] value value
+                * @return the number of voxels of the value.
+                * @note The total of 8^MAX_LEVEL voxels fits in a 64-bit size_t.
+                */
+                size_t count ( const T& value ) const {
+                        if ( value == this->_emptyValue ) {
+                                return ( size_t(1) << ( 3 * this->_level ) ) - this->count_nonempty();
+                        }
+                        size_t result = 0;
+                        for ( size_t i = 0 ; i < this->_values.size() ; ++i ) {
+                                if ( this->_values[i] == value ) result += size_t(1) << ( 3 * this->_levels[i] );
+                        }
+                        return result;
+                }
+
+                /**
+                * @return the number of voxels which are not the empty value.
+                */
+                size_t count_nonempty ( void ) const {
+                        size_t result = 0;
+                        for ( size_t i = 0 ; i < this->_levels.size() ; ++i ) result += size_t(1) << ( 3 * this->_levels[i] );
+                        return result;
+                }
+
+                /**
+                * @return a dimension of the octree. It must be a 2^n.
+                */
+                int getDimension ( void ) const {
+                        return this->_dimension;
+                }
+
+                /**
+                * @return empty value of the octree.
+                */
+                T getEmptyValue ( void ) const {
+                        return this->_emptyValue;
+                }
+
+                /**
+                * @return the number of stored (non-empty) leaves.
+                */
+                size_t size ( void ) const {
+                        return this->_keys.size();
+                }
+
+                /**
+                * @return the number of bytes used by the octree.
+                */
+                size_t bytes_used ( void ) const {
+                        return sizeof(*this) + this->_keys.capacity() * sizeof(uint64_t) + this->_levels.capacity()
+                               + this->_values.capacity() * sizeof(T) + this->_index.capacity() * sizeof(uint32_t);
+                }
+        private:
+                /**
+                * @brief append a leaf unless it is empty.
+                */
+                void push ( const uint64_t key, const unsigned char level, const T& value ) {
+                        if ( value == this->_emptyValue ) return;
+                        this->_keys.push_back( key );
+                        this->_levels.push_back( level );
+                        this->_values.push_back( value );
+                        return;
+                }
+
+                /**
+                * @brief release spare capacity.
+                * @retval false The leaves cannot be indexed by 32 bits.
+                */
+                bool finish ( void ) {
+                        if ( this->_keys.size() >= 0xFFFFFFFFu ) {
+                                this->clear();
+                                return false;
+                        }
+                        std::vector<uint64_t>( this->_keys ).swap( this->_keys );
+                        std::vector<unsigned char>( this->_levels ).swap( this->_levels );
+                        std::vector<T>( this->_values ).swap( this->_values );
+                        return true;
+                }
+
+                /**
+                * @brief read a node of the octree::write() format.
+                * @param[in] fin input file stream
+                * @param[in] level level of the node
+                * @param[in] key Morton code of the first voxel of the node
+                */
+                bool read_node ( std::ifstream& fin, const unsigned char level, const uint64_t key ) {
+                        unsigned char type;
+                        fin.read( (char*)&type, sizeof(unsigned char) );
+                        if ( fin.fail() ) return false;
+                        if ( type == 0x02 ) { // intermediate
+                                if ( level == 0 ) return false;
+                                for ( int i = 0 ; i < 8 ; ++i ) {
+                                        if ( !this->read_node( fin, level - 1, key | ( uint64_t(i) << ( 3 * ( level - 1 ) ) ) ) ) return false;
+                                }
+                                return true;
+                        }
+                        if ( type != 0x01 ) return false;
+                        T value;
+                        fin.read( (char*)&value, sizeof(T) );
+                        if ( fin.fail() ) return false;
+                        this->push( key, level, value );
+                        return true;
+                }
+        };
+};
+#endif// __LINEAR_OCTREE_HPP__
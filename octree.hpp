@@ -48,467 +48,3993 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <fstream>
 #include <cmath>
 #include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <stdint.h>
+#include <type_traits>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
 
 namespace mi
 {
         /**
-	 * @class octree
-	 * octree implements octree data structure.
-	 * @section ex Example code
-	 * @code
-        * #include <octree.hpp>
-        * int main ()
-        * {
-        *     int value;
-        *     mi::octree<int> tree(1024, 0);
+        * @class new_allocator
+        * @brief Allocates each block of 8 child nodes with new.
         *
-        *     tree.set( 100, 200, 300, 4);
+        * This is the default allocator of octree<T>. It keeps the same
+        * behavior as the original implementation (one heap allocation per split).
+        * B is the block type defined by octree<T> (8 child nodes and optional data).
         *
-        *     value = tree.get(100, 200, 300); // value = 4;
-        *     value = tree.get(  0, 300, 400); // value = 0;
+        * All allocators hand out integral handles. A handle of 0 means "no block"
+        * and the low 2 bits of a valid handle are always 0, so nodes can use them as tags.
+        */
+        template < typename B >
+        class new_allocator
+        {
+        public:
+                typedef uintptr_t handle; ///< Handle to a block.
+                static bool const bulk_release = false; ///< clear() does not release live blocks.
+                static bool const concurrent_resolve = true; ///< resolve() may run while another thread allocates.
+        private:
+                size_t _allocations;   ///< The number of allocated blocks.
+                size_t _deallocations; ///< The number of deallocated blocks.
+        private:
+                new_allocator ( const new_allocator& that );
+                void operator = ( const new_allocator& that );
+        public:
+                new_allocator ( void ) : _allocations(0), _deallocations(0) {
+                        return;
+                }
+
+                /**
+                * @brief allocate a default-constructed block.
+                * @return a handle to the block.
+                */
+                handle allocate ( void ) {
+                        static_assert( alignof(B) >= 4, "low 2 bits of handles are used as tags" );
+                        ++this->_allocations;
+                        return reinterpret_cast<handle>( new B() );
+                }
+
+                /**
+                * @brief deallocate a block returned by allocate().
+                * @param[in] h A handle to the block.
+                */
+                void deallocate ( const handle h ) {
+                        ++this->_deallocations;
+                        delete this->resolve(h);
+                        return;
+                }
+
+                /**
+                * @param[in] h A handle to the block.
+                * @return a pointer to the block.
+                */
+                B* resolve ( const handle h ) const {
+                        return reinterpret_cast<B*>( h );
+                }
+
+                /**
+                * @brief Do nothing. Live blocks must be deallocated one by one.
+                */
+                void clear ( void ) {
+                        return;
+                }
+
+                /**
+                * @brief Do nothing. Live blocks must be deallocated one by one.
+                */
+                void reset ( void ) {
+                        return;
+                }
+
+                /**
+                * @return the number of calls of allocate().
+                */
+                size_t allocations ( void ) const {
+                        return this->_allocations;
+                }
+
+                /**
+                * @return the number of calls of deallocate().
+                */
+                size_t deallocations ( void ) const {
+                        return this->_deallocations;
+                }
+
+                /**
+                * @return the number of blocks in use.
+                */
+                size_t live_blocks ( void ) const {
+                        return this->_allocations - this->_deallocations;
+                }
+
+                /**
+                * @return the number of bytes held by the allocator.
+                */
+                size_t reserved_bytes ( void ) const {
+                        return this->live_blocks() * sizeof(B);
+                }
+        };
+
+        /**
+        * @class pool_allocator
+        * @brief Hands out blocks of child nodes from large chunks.
         *
-        *     return 1;
-        * }
-        * @endcode
+        * Freed blocks are recycled through a free list. clear() releases all
+        * chunks at once without visiting the nodes, so octree<T> only walks
+        * the tree on destruction when T has a non-trivial destructor.
         */
-        template < typename T >
-        class  octree
+        template < typename B >
+        class pool_allocator
+        {
+        public:
+                typedef uintptr_t handle; ///< Handle to a block.
+                static bool const bulk_release = true; ///< clear() releases live blocks.
+                static bool const concurrent_resolve = true; ///< resolve() may run while another thread allocates.
+                static size_t const blocks_per_chunk = 1024; ///< The number of blocks in a chunk.
+        private:
+                union slot {
+                        slot* next; ///< Next free slot.
+                        typename std::aligned_storage< sizeof(B), alignof(B) >::type storage;
+                };
+
+                std::vector<slot*> _chunks;    ///< Allocated chunks.
+                slot*           _free;          ///< Head of the free list.
+                size_t          _used;          ///< The number of slots taken from the chunks (including free ones).
+                size_t          _allocations;   ///< The number of allocated blocks.
+                size_t          _deallocations; ///< The number of deallocated blocks.
+        private:
+                pool_allocator ( const pool_allocator& that );
+                void operator = ( const pool_allocator& that );
+        public:
+                pool_allocator ( void ) : _free(NULL), _used(0), _allocations(0), _deallocations(0) {
+                        return;
+                }
+
+                ~pool_allocator ( void ) {
+                        this->clear();
+                        return;
+                }
+
+                /**
+                * @brief allocate a default-constructed block.
+                * @return a handle to the block.
+                */
+                handle allocate ( void ) {
+                        static_assert( alignof(B) >= 4, "low 2 bits of handles are used as tags" );
+                        slot* s = this->_free;
+                        if ( s != NULL ) {
+                                this->_free = s->next;
+                        } else {
+                                if ( this->_used == this->_chunks.size() * blocks_per_chunk ) {
+                                        this->_chunks.push_back( static_cast<slot*>( ::operator new( sizeof(slot) * blocks_per_chunk ) ) );
+                                }
+                                s = this->_chunks[ this->_used / blocks_per_chunk ] + this->_used % blocks_per_chunk;
+                                ++this->_used;
+                        }
+                        B* p = new ( &(s->storage) ) B();
+                        ++this->_allocations;
+                        return reinterpret_cast<handle>( p );
+                }
+
+                /**
+                * @brief return a block to the free list.
+                * @param[in] h A handle to the block.
+                */
+                void deallocate ( const handle h ) {
+                        B* p = this->resolve(h);
+                        p->~B();
+                        slot* s = reinterpret_cast<slot*>( p );
+                        s->next = this->_free;
+                        this->_free = s;
+                        ++this->_deallocations;
+                        return;
+                }
+
+                /**
+                * @param[in] h A handle to the block.
+                * @return a pointer to the block.
+                */
+                B* resolve ( const handle h ) const {
+                        return reinterpret_cast<B*>( h );
+                }
+
+                /**
+                * @brief release all chunks.
+                * @note Destructors of live blocks are not called.
+                */
+                void clear ( void ) {
+                        for ( size_t i = 0 ; i < this->_chunks.size() ; ++i ) {
+                                ::operator delete( this->_chunks[i] );
+                        }
+                        this->_chunks.clear();
+                        this->_free = NULL;
+                        this->_used = 0;
+                        this->_deallocations = this->_allocations;
+                        return;
+                }
+
+                /**
+                * @brief release all blocks but keep the chunks for later allocations.
+                * @note Destructors of live blocks are not called.
+                */
+                void reset ( void ) {
+                        this->_free = NULL;
+                        this->_used = 0;
+                        this->_deallocations = this->_allocations;
+                        return;
+                }
+
+                /**
+                * @return the number of calls of allocate().
+                */
+                size_t allocations ( void ) const {
+                        return this->_allocations;
+                }
+
+                /**
+                * @return the number of released blocks (including clear()).
+                */
+                size_t deallocations ( void ) const {
+                        return this->_deallocations;
+                }
+
+                /**
+                * @return the number of blocks in use.
+                */
+                size_t live_blocks ( void ) const {
+                        return this->_allocations - this->_deallocations;
+                }
+
+                /**
+                * @return the number of allocated chunks.
+                */
+                size_t chunks ( void ) const {
+                        return this->_chunks.size();
+                }
+
+                /**
+                * @return the number of bytes held by the allocator.
+                */
+                size_t reserved_bytes ( void ) const {
+                        return this->_chunks.size() * blocks_per_chunk * sizeof(slot);
+                }
+        };
+
+        /**
+        * @class compact_allocator
+        * @brief Node pool addressed by 32-bit indices.
+        *
+        * Blocks live in contiguous chunks that are never moved, and a handle is
+        * (index + 1) << 2, so a node of octree<int> fits in 8 bytes.
+        * At most 2^30 - 1 blocks can be allocated.
+        */
+        template < typename B >
+        class compact_allocator
+        {
+        public:
+                typedef uint32_t handle; ///< Handle to a block.
+                static bool const bulk_release = true; ///< clear() releases live blocks.
+                static bool const concurrent_resolve = false; ///< allocate() may move the chunk table read by resolve().
+                static unsigned int const chunk_bits = 10; ///< log2 of the number of blocks in a chunk.
+                static size_t const blocks_per_chunk = size_t(1) << chunk_bits; ///< The number of blocks in a chunk.
+        private:
+                union slot {
+                        uint32_t next; ///< Index of the next free slot.
+                        typename std::aligned_storage< sizeof(B), alignof(B) >::type storage;
+                };
+                static uint32_t const NONE = 0xFFFFFFFF;
+
+                std::vector<slot*> _chunks;    ///< Allocated chunks.
+                uint32_t        _free;          ///< Index of the first free slot.
+                uint32_t        _size;          ///< The number of used slots (including free ones).
+                size_t          _allocations;   ///< The number of allocated blocks.
+                size_t          _deallocations; ///< The number of deallocated blocks.
+        private:
+                compact_allocator ( const compact_allocator& that );
+                void operator = ( const compact_allocator& that );
+        public:
+                compact_allocator ( void ) : _free(NONE), _size(0), _allocations(0), _deallocations(0) {
+                        return;
+                }
+
+                ~compact_allocator ( void ) {
+                        this->clear();
+                        return;
+                }
+
+                /**
+                * @brief allocate a default-constructed block.
+                * @return a handle to the block.
+                * @exception std::bad_alloc The index space is exhausted.
+                */
+                handle allocate ( void ) {
+                        uint32_t id = this->_free;
+                        if ( id != NONE ) {
+                                this->_free = this->get_slot(id)->next;
+                        } else {
+                                if ( this->_size >= ( uint32_t(1) << 30 ) - 1 ) throw std::bad_alloc();
+                                if ( this->_size == this->_chunks.size() * blocks_per_chunk ) {
+                                        this->_chunks.push_back( static_cast<slot*>( ::operator new( sizeof(slot) * blocks_per_chunk ) ) );
+                                }
+                                id = this->_size++;
+                        }
+                        new ( &(this->get_slot(id)->storage) ) B();
+                        ++this->_allocations;
+                        return ( id + 1 ) << 2;
+                }
+
+                /**
+                * @brief return a block to the free list.
+                * @param[in] h A handle to the block.
+                */
+                void deallocate ( const handle h ) {
+                        this->resolve(h)->~B();
+                        const uint32_t id = ( h >> 2 ) - 1;
+                        this->get_slot(id)->next = this->_free;
+                        this->_free = id;
+                        ++this->_deallocations;
+                        return;
+                }
+
+                /**
+                * @param[in] h A handle to the block.
+                * @return a pointer to the block.
+                */
+                B* resolve ( const handle h ) const {
+                        return reinterpret_cast<B*>( &(this->get_slot( ( h >> 2 ) - 1 )->storage) );
+                }
+
+                /**
+                * @brief release all chunks.
+                * @note Destructors of live blocks are not called.
+                */
+                void clear ( void ) {
+                        for ( size_t i = 0 ; i < this->_chunks.size() ; ++i ) {
+                                ::operator delete( this->_chunks[i] );
+                        }
+                        this->_chunks.clear();
+                        this->_free = NONE;
+                        this->_size = 0;
+                        this->_deallocations = this->_allocations;
+                        return;
+                }
+
+                /**
+                * @brief release all blocks but keep the chunks for later allocations.
+                * @note Destructors of live blocks are not called.
+                */
+                void reset ( void ) {
+                        this->_free = NONE;
+                        this->_size = 0;
+                        this->_deallocations = this->_allocations;
+                        return;
+                }
+
+                /**
+                * @return the number of calls of allocate().
+                */
+                size_t allocations ( void ) const {
+                        return this->_allocations;
+                }
+
+                /**
+                * @return the number of released blocks (including clear()).
+                */
+                size_t deallocations ( void ) const {
+                        return this->_deallocations;
+                }
+
+                /**
+                * @return the number of blocks in use.
+                */
+                size_t live_blocks ( void ) const {
+                        return this->_allocations - this->_deallocations;
+                }
+
+                /**
+                * @return the number of allocated chunks.
+                */
+                size_t chunks ( void ) const {
+                        return this->_chunks.size();
+                }
+
+                /**
+                * @return the number of bytes held by the allocator.
+                */
+                size_t reserved_bytes ( void ) const {
+                        return this->_chunks.size() * blocks_per_chunk * sizeof(slot)
+                               + this->_chunks.capacity() * sizeof(slot*);
+                }
+        private:
+                slot* get_slot ( const uint32_t id ) const {
+                        return this->_chunks[ id >> chunk_bits ] + ( id & ( blocks_per_chunk - 1 ) );
+                }
+        };
+
+#ifdef MI_OCTREE_PROFILE
+        /**
+        * @class profiled_allocator
+        * @brief Allocator A counting splits and merges of the nodes it serves.
+        *
+        * octree<T> uses it in place of its allocator when MI_OCTREE_PROFILE is
+        * defined (see octree::get_profile()). The threaded builders attach new
+        * blocks without splitting leaves.
+        */
+        template < typename B, template < typename > class A >
+        class profiled_allocator : public A<B>
+        {
+        private:
+                mutable std::atomic<size_t> _splits; ///< The number of leaves split into 8 child nodes.
+                mutable std::atomic<size_t> _merges; ///< The number of subtrees replaced by a leaf.
+        public:
+                profiled_allocator ( void ) : _splits(0), _merges(0) {
+                        return;
+                }
+
+                void count_split ( void ) const {
+                        this->_splits.fetch_add( 1, std::memory_order_relaxed );
+                        return;
+                }
+
+                void count_merge ( void ) const {
+                        this->_merges.fetch_add( 1, std::memory_order_relaxed );
+                        return;
+                }
+
+                /**
+                * @return the number of leaves split into 8 child nodes.
+                */
+                size_t splits ( void ) const {
+                        return this->_splits.load( std::memory_order_relaxed );
+                }
+
+                /**
+                * @return the number of subtrees replaced by a leaf.
+                */
+                size_t merges ( void ) const {
+                        return this->_merges.load( std::memory_order_relaxed );
+                }
+        };
+#endif
+
+        /**
+        * @class morton_code
+        * @brief Morton (Z-order) codes of 21-bit coordinates.
+        *
+        * The 3 bits of level l of a code are the child index at level l
+        * (x in the lowest bit), so sorting codes sorts points in octree order.
+        */
+        class morton_code
+        {
+        public:
+                static unsigned char const MAX_LEVEL = 21; ///< 3 * 21 bits fit in a 64-bit code.
+
+                /**
+                * @param[in] v coordinate (21 bits)
+                * @return v with two zero bits inserted after each bit.
+                */
+                static uint64_t spread_bits ( const uint64_t v ) {
+                        uint64_t x = v & 0x1FFFFF;
+                        x = ( x | ( x << 32 ) ) & 0x001F00000000FFFFULL;
+                        x = ( x | ( x << 16 ) ) & 0x001F0000FF0000FFULL;
+                        x = ( x | ( x <<  8 ) ) & 0x100F00F00F00F00FULL;
+                        x = ( x | ( x <<  4 ) ) & 0x10C30C30C30C30C3ULL;
+                        x = ( x | ( x <<  2 ) ) & 0x1249249249249249ULL;
+                        return x;
+                }
+
+                /**
+                * @return every third bit of v packed (the inverse of spread_bits()).
+                */
+                static int compact_bits ( const uint64_t v ) {
+                        uint64_t x = v & 0x1249249249249249ULL;
+                        x = ( x | ( x >>  2 ) ) & 0x10C30C30C30C30C3ULL;
+                        x = ( x | ( x >>  4 ) ) & 0x100F00F00F00F00FULL;
+                        x = ( x | ( x >>  8 ) ) & 0x001F0000FF0000FFULL;
+                        x = ( x | ( x >> 16 ) ) & 0x001F00000000FFFFULL;
+                        x = ( x | ( x >> 32 ) ) & 0x1FFFFF;
+                        return static_cast<int>(x);
+                }
+
+                /**
+                * @return Morton code of (x, y, z).
+                */
+                static uint64_t encode ( const int x, const int y, const int z ) {
+                        return spread_bits(x) | ( spread_bits(y) << 1 ) | ( spread_bits(z) << 2 );
+                }
+        };
+
+        /**
+        * @class lz_codec
+        * @brief Small LZ77 block codec in the spirit of LZ4.
+        *
+        * A compressed block is a sequence of (token, literals, offset, match) where
+        * the token holds the literal length (high 4 bits) and the match length - 4
+        * (low 4 bits). Lengths of 15 are continued with bytes of 255. The last
+        * sequence has literals only.
+        */
+        class lz_codec
         {
         private:
+                static unsigned int const HASH_BITS = 12;
+                static size_t const MIN_MATCH = 4;
+                static size_t const MAX_OFFSET = 0xFFFF;
+
+                static uint32_t read32 ( const uint8_t* p ) {
+                        uint32_t v;
+                        std::memcpy( &v, p, 4 );
+                        return v;
+                }
+
+                static void put_length ( std::vector<uint8_t>& out, size_t n ) {
+                        while ( n >= 255 ) {
+                                out.push_back( 255 );
+                                n -= 255;
+                        }
+                        out.push_back( static_cast<uint8_t>( n ) );
+                        return;
+                }
+
+                static void put_sequence ( std::vector<uint8_t>& out, const uint8_t* literal, const size_t literals, const size_t offset, const size_t match ) {
+                        const size_t m = ( match == 0 ) ? 0 : match - MIN_MATCH;
+                        out.push_back( static_cast<uint8_t>( ( std::min<size_t>( literals, 15 ) << 4 ) | std::min<size_t>( m, 15 ) ) );
+                        if ( literals >= 15 ) put_length( out, literals - 15 );
+                        out.insert( out.end(), literal, literal + literals );
+                        if ( match == 0 ) return;
+                        out.push_back( static_cast<uint8_t>( offset & 0xFF ) );
+                        out.push_back( static_cast<uint8_t>( offset >> 8 ) );
+                        if ( m >= 15 ) put_length( out, m - 15 );
+                        return;
+                }
+
+                static bool get_length ( const uint8_t*& p, const uint8_t* end, size_t& n ) {
+                        uint8_t b;
+                        do {
+                                if ( p == end ) return false;
+                                b = *p++;
+                                n += b;
+                        } while ( b == 255 );
+                        return true;
+                }
+        public:
+                /**
+                * @brief compress a block.
+                * @param[in] in input bytes
+                * @param[in] size the number of input bytes
+                * @param[out] out compressed bytes
+                */
+                static void compress ( const uint8_t* in, const size_t size, std::vector<uint8_t>& out ) {
+                        out.clear();
+                        std::vector<uint32_t> table( size_t(1) << HASH_BITS, 0xFFFFFFFF );
+                        size_t anchor = 0;
+                        size_t i = 0;
+                        while ( i + MIN_MATCH <= size ) {
+                                const uint32_t v = read32( in + i );
+                                const uint32_t h = ( v * 2654435761U ) >> ( 32 - HASH_BITS );
+                                const uint32_t candidate = table[h];
+                                table[h] = static_cast<uint32_t>( i );
+                                if ( candidate != 0xFFFFFFFF && i - candidate <= MAX_OFFSET && read32( in + candidate ) == v ) {
+                                        size_t match = MIN_MATCH;
+                                        while ( i + match < size && in[candidate + match] == in[i + match] ) ++match;
+                                        put_sequence( out, in + anchor, i - anchor, i - candidate, match );
+                                        i += match;
+                                        anchor = i;
+                                } else {
+                                        ++i;
+                                }
+                        }
+                        put_sequence( out, in + anchor, size - anchor, 0, 0 );
+                        return;
+                }
+
+                /**
+                * @brief decompress a block.
+                * @param[in] in compressed bytes
+                * @param[in] size the number of compressed bytes
+                * @param[out] out decompressed bytes
+                * @param[in] capacity the expected number of decompressed bytes
+                * @retval true Succeeded.
+                * @retval false The block is corrupted.
+                */
+                static bool decompress ( const uint8_t* in, const size_t size, uint8_t* out, const size_t capacity ) {
+                        const uint8_t* p = in;
+                        const uint8_t* end = in + size;
+                        size_t o = 0;
+                        while ( p < end ) {
+                                const uint8_t token = *p++;
+                                size_t literals = token >> 4;
+                                if ( literals == 15 && !get_length( p, end, literals ) ) return false;
+                                if ( static_cast<size_t>( end - p ) < literals || capacity - o < literals ) return false;
+                                std::memcpy( out + o, p, literals );
+                                p += literals;
+                                o += literals;
+                                if ( p == end ) break;
+                                if ( end - p < 2 ) return false;
+                                const size_t offset = p[0] | ( static_cast<size_t>( p[1] ) << 8 );
+                                p += 2;
+                                size_t match = token & 0x0F;
+                                if ( match == 15 && !get_length( p, end, match ) ) return false;
+                                match += MIN_MATCH;
+                                if ( offset == 0 || offset > o || capacity - o < match ) return false;
+                                for ( size_t i = 0 ; i < match ; ++i, ++o ) out[o] = out[o - offset];
+                        }
+                        return o == capacity;
+                }
+
+                /**
+                * @return FNV-1a hash of the bytes (used as a block checksum).
+                */
+                static uint32_t checksum ( const uint8_t* p, const size_t size ) {
+                        uint32_t h = 2166136261U;
+                        for ( size_t i = 0 ; i < size ; ++i ) {
+                                h ^= p[i];
+                                h *= 16777619U;
+                        }
+                        return h;
+                }
+        };
+
+        /**
+        * @class block_writer
+        * @brief Buffers bytes into blocks, compresses them and writes them with a checksum.
+        *
+        * Each block is stored as (raw size, stored size, checksum, data). A block is
+        * kept uncompressed when compression does not make it smaller, and a raw size
+        * of 0 ends the stream.
+        */
+        class block_writer
+        {
+        public:
+                static size_t const BLOCK_SIZE = size_t(1) << 16; ///< Maximum size of a block.
+        private:
+                std::ostream&           _out;      ///< Output stream.
+                bool                    _compress; ///< Compress blocks or not.
+                std::vector<uint8_t>    _buffer;   ///< Current block.
+                std::vector<uint8_t>    _packed;   ///< Compressed block.
+        private:
+                block_writer ( const block_writer& that );
+                void operator = ( const block_writer& that );
+        public:
+                /**
+                * @param[in] out output stream
+                * @param[in] compress compress blocks or not
+                */
+                block_writer ( std::ostream& out, const bool compress ) : _out(out), _compress(compress) {
+                        this->_buffer.reserve( BLOCK_SIZE );
+                        return;
+                }
+
+                /**
+                * @brief append bytes.
+                * @retval true Succeeded.
+                * @retval false Failed to write a block.
+                */
+                bool write ( const void* data, size_t size ) {
+                        const uint8_t* p = static_cast<const uint8_t*>( data );
+                        while ( size > 0 ) {
+                                const size_t n = std::min( size, BLOCK_SIZE - this->_buffer.size() );
+                                this->_buffer.insert( this->_buffer.end(), p, p + n );
+                                p += n;
+                                size -= n;
+                                if ( this->_buffer.size() == BLOCK_SIZE && !this->flush() ) return false;
+                        }
+                        return true;
+                }
+
+                /**
+                * @brief append a byte.
+                */
+                bool put ( const uint8_t c ) {
+                        this->_buffer.push_back( c );
+                        if ( this->_buffer.size() == BLOCK_SIZE ) return this->flush();
+                        return true;
+                }
+
+                /**
+                * @brief write the current block.
+                * @retval true Succeeded.
+                * @retval false I/O error.
+                */
+                bool flush ( void ) {
+                        if ( this->_buffer.empty() ) return !this->_out.fail();
+                        const uint8_t* data = &this->_buffer[0];
+                        uint32_t header[3];
+                        header[0] = static_cast<uint32_t>( this->_buffer.size() );
+                        header[1] = header[0];
+                        header[2] = lz_codec::checksum( data, this->_buffer.size() );
+                        if ( this->_compress ) {
+                                lz_codec::compress( data, this->_buffer.size(), this->_packed );
+                                if ( this->_packed.size() < this->_buffer.size() ) {
+                                        data = &this->_packed[0];
+                                        header[1] = static_cast<uint32_t>( this->_packed.size() );
+                                }
+                        }
+                        this->_out.write( (char*)header, sizeof(header) );
+                        this->_out.write( (const char*)data, header[1] );
+                        this->_buffer.clear();
+                        return !this->_out.fail();
+                }
+
+                /**
+                * @brief write the current block and the end of the stream.
+                * @retval true Succeeded.
+                * @retval false I/O error.
+                */
+                bool finish ( void ) {
+                        if ( !this->flush() ) return false;
+                        const uint32_t header[3] = { 0, 0, 0 };
+                        this->_out.write( (const char*)header, sizeof(header) );
+                        this->_out.flush();
+                        return !this->_out.fail();
+                }
+        };
+
+        /**
+        * @class block_reader
+        * @brief Reads blocks written by block_writer and checks their checksums.
+        */
+        class block_reader
+        {
+        private:
+                std::istream&           _in;     ///< Input stream.
+                std::vector<uint8_t>    _buffer; ///< Current block.
+                std::vector<uint8_t>    _packed; ///< Compressed block.
+                size_t                  _pos;    ///< Read position in the current block.
+                bool                    _end;    ///< The end of the stream was read.
+        private:
+                block_reader ( const block_reader& that );
+                void operator = ( const block_reader& that );
+        public:
+                /**
+                * @param[in] in input stream
+                */
+                explicit block_reader ( std::istream& in ) : _in(in), _pos(0), _end(false) {
+                        return;
+                }
+
+                /**
+                * @brief read bytes.
+                * @retval true Succeeded.
+                * @retval false I/O error, corrupted block or the end of the stream.
+                */
+                bool read ( void* data, size_t size ) {
+                        uint8_t* p = static_cast<uint8_t*>( data );
+                        while ( size > 0 ) {
+                                if ( this->_pos == this->_buffer.size() && !this->next_block() ) return false;
+                                const size_t n = std::min( size, this->_buffer.size() - this->_pos );
+                                std::memcpy( p, &this->_buffer[this->_pos], n );
+                                this->_pos += n;
+                                p += n;
+                                size -= n;
+                        }
+                        return true;
+                }
+
+                /**
+                * @brief read a byte.
+                */
+                bool get ( uint8_t& c ) {
+                        return this->read( &c, 1 );
+                }
+
+                /**
+                * @retval true All blocks were consumed and the end of the stream was read.
+                */
+                bool finish ( void ) {
+                        if ( this->_pos != this->_buffer.size() ) return false;
+                        return this->_end || ( !this->next_block() && this->_end );
+                }
+        private:
+                bool next_block ( void ) {
+                        if ( this->_end ) return false;
+                        uint32_t header[3];
+                        this->_in.read( (char*)header, sizeof(header) );
+                        if ( this->_in.fail() ) return false;
+                        if ( header[0] == 0 ) {
+                                this->_end = true;
+                                return false;
+                        }
+                        if ( header[0] > block_writer::BLOCK_SIZE || header[1] > header[0] ) return false;
+                        this->_buffer.resize( header[0] );
+                        if ( header[1] == header[0] ) {
+                                this->_in.read( (char*)&this->_buffer[0], header[1] );
+                                if ( this->_in.fail() ) return false;
+                        } else {
+                                this->_packed.resize( header[1] );
+                                this->_in.read( (char*)&this->_packed[0], header[1] );
+                                if ( this->_in.fail() ) return false;
+                                if ( !lz_codec::decompress( &this->_packed[0], header[1], &this->_buffer[0], header[0] ) ) return false;
+                        }
+                        if ( lz_codec::checksum( &this->_buffer[0], header[0] ) != header[2] ) return false;
+                        this->_pos = 0;
+                        return true;
+                }
+        };
+
+        /**
+        * @struct flat_header
+        * @brief Header of the flat file format written by octree::write_flat().
+        *
+        * The header is followed by a record holding the empty value and by the
+        * node records in breadth-first order. The 8 children of the record i are
+        * the records i + child, ..., i + child + 7 (child = 0 for a leaf).
+        * @see octree_view
+        */
+        struct flat_header {
+                static uint32_t const ENDIAN_MARK = 0x01020304; ///< Byte order mark.
+                static uint32_t const VERSION = 1; ///< Current version.
+
+                char     magic[8];     ///< "MIOCTREE"
+                uint32_t byte_order;   ///< ENDIAN_MARK in the byte order of the writer
+                uint32_t version;      ///< Format version
+                uint32_t value_size;   ///< sizeof(T)
+                uint32_t record_size;  ///< sizeof(flat_record<T>)
+                int32_t  dimension;    ///< Size of the octree
+                uint32_t level;        ///< Maximum level of the octree
+                uint64_t records;      ///< The number of node records
+                char     reserved[24]; ///< Padding to 64 bytes
+        };
+
+        /**
+        * @struct flat_record
+        * @brief Node record of the flat file format.
+        */
+        template < typename T >
+        struct flat_record {
+                uint32_t child; ///< Offset to the first child record (0 : leaf)
+                T        value; ///< Value of a leaf
+        };
+
+        /**
+        * @struct no_statistics
+        * @brief Statistics policy of octree<T> : nothing is cached (default).
+        */
+        struct no_statistics {
+                static bool const enabled = false;
+                template < typename T > struct storage {};
+        };
+
+        /**
+        * @struct subtree_statistics
+        * @brief Statistics policy of octree<T> : every intermediate node caches
+        * the number of non-empty voxels and the range of values in its subtree.
+        * @note T must support operator<.
+        */
+        struct subtree_statistics {
+                static bool const enabled = true;
+                template < typename T > struct storage {
+                        uint64_t nonempty; ///< The number of non-empty voxels.
+                        T min; ///< Minimum value.
+                        T max; ///< Maximum value.
+                };
+        };
+
+        /**
+	 * @class octree
+	 * octree implements octree data structure.
+	 * @section ex Example code
+	 * @code
+        * #include <octree.hpp>
+        * int main ()
+        * {
+        *     int value;
+        *     mi::octree<int> tree(1024, 0);
+        *
+        *     tree.set( 100, 200, 300, 4);
+        *
+        *     value = tree.get(100, 200, 300); // value = 4;
+        *     value = tree.get(  0, 300, 400); // value = 0;
+        *
+        *     return 1;
+        * }
+        * @endcode
+        * The second template parameter selects the allocator of child nodes
+        * (mi::new_allocator, mi::pool_allocator or mi::compact_allocator).
+        * The third one selects cached statistics (mi::no_statistics or mi::subtree_statistics).
+        */
+        template < typename T, template < typename > class Allocator = new_allocator, typename Statistics = no_statistics >
+        class  octree
+        {
+        private:
+                struct block;
+
+                /**
+                * @class node
+                * @brief octree node (used in only octree<T>
+                */
+                template < typename U >
+                class node
+                {
+                public:
+#ifdef MI_OCTREE_PROFILE
+                        typedef profiled_allocator< block, Allocator > allocator_type;
+#else
+                        typedef Allocator< block > allocator_type;
+#endif
+                        typedef typename allocator_type::handle handle;
+
+                        //definition of records in the file format
+                        static unsigned char const EMPTY = 0x01; ///< Empty voxel
+                        static unsigned char const INTERMEDIATE = 0x02; ///< Intermediate voxel
+                private:
+                        //tag bits packed into the low bits of _child
+                        static handle const INTERMEDIATE_BIT = 0x01; ///< The node has child nodes.
+                        static handle const STALE_BIT = 0x02; ///< The reduced value of an intermediate node is out of date.
+                        static handle const TAG_MASK = 0x03; ///< All tag bits.
+
+                private:
+                        handle	_child; ///< Handle to child nodes | tag bits
+                        U 	_value; ///< Value
+
+                public:
+                        /**
+                        * @brief Default Contructor
+                        * @note Used in only allocators.
+                        */
+                        node( void ) : _child(0), _value() {
+                                return;
+                        }
+
+                        /**
+                        * @brief Constructor
+                        * @param[in] value Set value.
+                        */
+                        explicit node( const U& value ) : _child(0), _value(value) {
+                                return;
+                        }
+
+                        /**
+                        * @retval true The node has no child nodes.
+                        * @retval false The node is an intermediate node.
+                        */
+                        bool is_leaf ( void ) const {
+                                return ( this->_child & INTERMEDIATE_BIT ) == 0;
+                        }
+
+                        /**
+                        * @return the value of the node.
+                        */
+                        const U& value ( void ) const {
+                                return this->_value;
+                        }
+
+                        /**
+                        * @param[in] v value
+                        */
+                        void set_value ( const U& v ) {
+                                this->_value = v;
+                                return;
+                        }
+
+                        /**
+                        * @param[in] v value (moved)
+                        */
+                        void set_value ( U&& v ) {
+                                this->_value = std::move(v);
+                                return;
+                        }
+
+                        /**
+                        * @brief make the node intermediate with already filled child nodes.
+                        * @param[in] h A handle to the block of child nodes.
+                        * @note the node must be a leaf.
+                        */
+                        void attach_children ( const handle h ) {
+                                this->_child = h | INTERMEDIATE_BIT;
+                                return;
+                        }
+
+                        /**
+                        * @retval true The value of the intermediate node must be reduced again.
+                        * @retval false The node is a leaf or its reduced value is up to date.
+                        */
+                        bool is_stale ( void ) const {
+                                return ( this->_child & STALE_BIT ) != 0;
+                        }
+
+                        /**
+                        * @brief mark the reduced value of an intermediate node out of date (no effect on leaves).
+                        */
+                        void mark_stale ( void ) {
+                                if ( !this->is_leaf() ) this->_child |= STALE_BIT;
+                                return;
+                        }
+
+                        /**
+                        * @brief set the reduced value of an intermediate node.
+                        * @param[in] v value
+                        */
+                        void set_reduced ( const U& v ) {
+                                this->_value = v;
+                                this->_child &= ~STALE_BIT;
+                                return;
+                        }
+
+                        /**
+                        * @param[in] alloc allocator of child nodes
+                        * @return a pointer to the 8 child nodes.
+                        * @note valid only if the node is not a leaf.
+                        */
+                        node<U>* children ( const allocator_type& alloc ) const {
+                                return alloc.resolve( this->_child & ~TAG_MASK )->child;
+                        }
+
+                        /**
+                        * @param[in] alloc allocator of child nodes
+                        * @return a pointer to the block of child nodes.
+                        * @note valid only if the node is not a leaf.
+                        */
+                        block* get_block ( const allocator_type& alloc ) const {
+                                return alloc.resolve( this->_child & ~TAG_MASK );
+                        }
+
+                        /**
+                        * @return a handle to the block of child nodes.
+                        * @note valid only if the node is not a leaf.
+                        */
+                        handle get_handle ( void ) const {
+                                return this->_child & ~TAG_MASK;
+                        }
+
+                        /**
+                        * @param[in] alloc allocator of child nodes
+                        * @retval true The child nodes are shared with a snapshot (copy before writing).
+                        * @retval false The node is a leaf or owns its child nodes.
+                        */
+                        bool is_shared ( const allocator_type& alloc ) const {
+                                return !this->is_leaf() && this->get_block(alloc)->_refs.load( std::memory_order_acquire ) > 1;
+                        }
+
+                        /**
+                        * @param[in] x x-coordinate
+                        * @param[in] y y-coordinate
+                        * @param[in] z z-coordinate
+                        * @param[in] level Level of the child nodes.
+                        * @return the index of the child node containing (x, y, z).
+                        */
+                        static int child_index ( const int x, const int y, const int z, const unsigned char level ) {
+                                return ( ( x >> level ) & 1 ) | ( ( ( y >> level ) & 1 ) << 1 ) | ( ( ( z >> level ) & 1 ) << 2 );
+                        }
+
+                        /**
+                        * @brief get value at (x, y, z)
+                        * @param[in] level Current level.
+                        * @param[in] x x-coordinate
+                        * @param[in] y y-coordinate
+                        * @param[in] z z-coordinate
+                        * @param[in] alloc allocator of child nodes
+                        * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                        */
+                        T get (const unsigned char level, const int x, const int y, const int z, const allocator_type& alloc) const {
+                                const node<U>* n = this;
+                                unsigned char l = level;
+                                while ( !n->is_leaf() ) {
+                                        --l;
+                                        n = n->children(alloc) + child_index(x, y, z, l);
+                                }
+                                return n->_value;
+                        }
+                        /**
+                        * @brief set value at (x, y, z)
+                        * @param[in] level Current level.
+                        * @param[in] x x-coordinate
+                        * @param[in] y y-coordinate
+                        * @param[in] z z-coordinate
+                        * @param[in] v value (U or U&&)
+                        * @param[in] alloc allocator of child nodes
+                        * @note do nothing if (x,y,z) is invalid.
+                        */
+                        template < typename V >
+                        void set (const unsigned char level, const int x, const int y, const int z, V&& v, allocator_type& alloc) {
+                                node<U>* n = this;
+                                for ( unsigned char l = level ; l > 0 ; ) {
+                                        n->create_child(alloc);
+                                        --l;
+                                        n = n->children(alloc) + child_index(x, y, z, l);
+                                }
+                                n->_value = std::forward<V>(v);
+                                return;
+                        }
+
+
+                        /**
+                        * @param[in] level Current level.
+                        * @param[in] tree the octree (empty value, allocator and cached statistics)
+                        * @retval true Succeeded.
+                        * @retval false Failed.
+                        */
+                        bool boundingbox(const unsigned char level, const octree& tree,
+                                         int& mnx, int& mny, int& mnz,
+                                         int& mxx, int& mxy, int& mxz) const {
+                                const U& emptyValue = tree._emptyValue;
+                                const allocator_type& alloc = tree._shared->allocator;
+                                const int d = 1 << level;
+                                mnx = mny = mnz = d - 1;
+                                mxx = mxy = mxz = 0;
+
+                                if ( this->is_leaf() ) {
+                                        if ( this->_value != emptyValue) {
+                                                mnx = mny = mnz = 0;
+                                                mxx = mxy = mxz = d - 1;
+                                                return true;
+                                        } else {
+                                                return false;
+                                        }
+                                } else {
+                                        const node<U>* child = this->children(alloc);
+                                        for (int z = 0 ; z < 2 ; z++) {
+                                                for (int y = 0 ; y < 2 ; y++) {
+                                                        for (int x = 0 ; x < 2 ; x++) {
+                                                                const int id = x + 2 * y + 4 * z;
+
+                                                                int lnx, lny, lnz, lxx, lxy, lxz;
+                                                                if ( tree.is_empty_subtree(child[id], level - 1) ) continue;
+                                                                if ( !child[id].boundingbox(level - 1, tree, lnx, lny, lnz, lxx, lxy, lxz) ) continue;
+                                                                const int offx = d/2 * x;
+                                                                const int offy = d/2 * y;
+                                                                const int offz = d/2 * z;
+
+                                                                lnx += offx;
+                                                                lny += offy;
+                                                                lnz += offz;
+
+                                                                lxx += offx;
+                                                                lxy += offy;
+                                                                lxz += offz;
+
+                                                                if ( lnx < mnx ) mnx = lnx;
+                                                                if ( lny < mny ) mny = lny;
+                                                                if ( lnz < mnz ) mnz = lnz;
+                                                                if ( lxx > mxx ) mxx = lxx;
+                                                                if ( lxy > mxy ) mxy = lxy;
+                                                                if ( lxz > mxz ) mxz = lxz;
+                                                        }
+                                                }
+                                        }
+                                        return mnx <= mxx && mny <= mxy && mnz <= mxz;
+                                }
+                        }
+
+                        /**
+                        * @brief merge uniform subtrees bottom-up.
+                        * @param[in] alloc allocator of child nodes
+                        * @param[out] freed handles of detached blocks (to be deallocated by the caller)
+                        * @return the number of freed nodes.
+                        */
+                        size_t optimize( const allocator_type& alloc, std::vector<handle>& freed ) {
+                                if ( this->is_leaf() || this->is_shared(alloc) ) return 0;
+                                size_t count = 0;
+                                node<U>* child = this->children(alloc);
+                                for ( int i = 0 ; i < 8 ; i++ ) {
+                                        count += child[i].optimize(alloc, freed);
+                                }
+                                return count + this->merge_uniform(alloc, freed);
+                        }
+
+                        /**
+                        * @brief make the node a leaf if all child nodes are leaves with the same value.
+                        * @param[in] alloc allocator of child nodes
+                        * @param[out] freed handles of detached blocks (to be deallocated by the caller)
+                        * @return the number of freed nodes (0 or 8).
+                        */
+                        size_t merge_uniform( const allocator_type& alloc, std::vector<handle>& freed ) {
+                                if ( this->is_leaf() || this->is_shared(alloc) ) return 0;
+                                const node<U>* child = this->children(alloc);
+                                for ( int i = 0 ; i < 8 ; i++ ) {
+                                        if ( !child[i].is_leaf() || !( child[i]._value == child[0]._value ) ) return 0;
+                                }
+#ifdef MI_OCTREE_PROFILE
+                                alloc.count_merge();
+#endif
+                                this->_value = child[0]._value;
+                                freed.push_back( this->_child & ~TAG_MASK );
+                                this->_child = 0;
+                                return 8;
+                        }
+                        bool read ( std::ifstream& fin, allocator_type& alloc ) {
+                                unsigned char type;
+                                fin.read( (char*)&type, sizeof(unsigned char) );
+                                if ( fin.fail() ) return false;
+                                switch ( type ) {
+                                case INTERMEDIATE:
+                                        this->create_child(alloc);
+                                        for ( int i = 0 ; i < 8 ; i++) {
+                                                if ( !this->children(alloc)[i].read(fin, alloc) ) return false;
+                                        }
+                                        return true;
+
+                                case EMPTY:
+                                        fin.read( (char*)&_value, sizeof(U) );
+                                        return !fin.bad();
+                                }
+                                return false;
+                        }
+
+                        /**
+                        * @param[in] fout output file stream
+                        * @param[in] alloc allocator of child nodes
+                        * @retval true Succeeded.
+                        * @retval false Failed.
+                        */
+                        bool write ( std::ofstream& fout, const allocator_type& alloc ) const {
+                                const unsigned char type = this->is_leaf() ? EMPTY : INTERMEDIATE;
+                                fout.write((char*)&type, 1);
+                                if ( type == INTERMEDIATE ) {
+                                        const node<U>* child = this->children(alloc);
+                                        for ( int i = 0 ; i < 8 ; i++) {
+                                                if ( !child[i].write(fout, alloc)) return false;
+                                        }
+                                        return true;
+                                }
+                                fout.write( (char*) &(_value), sizeof(U) );
+                                return true;
+                        }
+                        /**
+                        * @brief Copy object.
+                        * @param[in] d Copying instances.
+                        * @param[in] from allocator of child nodes of d
+                        * @param[in] alloc allocator of child nodes
+                        */
+                        void copy ( const node<U>& d, const allocator_type& from, allocator_type& alloc ) {
+                                this->remove_child(alloc);
+                                this->_value = d._value;
+                                if ( !d.is_leaf() ) {
+                                        this->create_child(alloc);
+                                        const node<U>* src = d.children(from);
+                                        for (int i = 0 ; i < 8 ; i++) {
+                                                this->children(alloc)[i].copy(src[i], from, alloc);
+                                        }
+                                }
+                                return;
+                        }
+                        /**
+                        * @brief Initializing child nodes.
+                        * @param[in] value Value.
+                        */
+                        void init ( const U& value ) {
+                                this->_value 		= value;
+                                return;
+                        };
+
+                        /**
+                        * @brief allocating child nodes, or copying them if they are shared.
+                        *
+                        * After this call the child nodes can be written.
+                        * @param[in] alloc allocator of child nodes
+                        */
+                        void create_child( allocator_type& alloc ) {
+                                if ( this->is_leaf() ) {
+#ifdef MI_OCTREE_PROFILE
+                                        alloc.count_split();
+#endif
+                                        const handle h = alloc.allocate();
+                                        node<U>* child = alloc.resolve(h)->child;
+                                        for ( int i = 0 ; i < 8 ; ++i) {
+                                                child[i].init(this->_value);
+                                        }
+                                        this->_child = h | INTERMEDIATE_BIT;
+                                } else if ( this->is_shared(alloc) ) {
+                                        this->unshare_child(alloc);
+                                }
+                                return;
+                        }
+
+                        /**
+                        * @brief replace shared child nodes by a private copy (grandchildren stay shared).
+                        * @param[in] alloc allocator of child nodes
+                        */
+                        void unshare_child( allocator_type& alloc ) {
+                                const handle old = this->_child & ~TAG_MASK;
+                                const handle h = alloc.allocate();
+                                block* dst = alloc.resolve(h);
+                                const block* src = alloc.resolve(old);
+                                static_cast<typename Statistics::template storage<U>&>( *dst ) = *src;
+                                for ( int i = 0 ; i < 8 ; ++i ) {
+                                        dst->child[i] = src->child[i];
+                                        if ( !src->child[i].is_leaf() ) src->child[i].get_block(alloc)->_refs.fetch_add( 1, std::memory_order_relaxed );
+                                }
+                                this->_child = h | ( this->_child & STALE_BIT ) | INTERMEDIATE_BIT;
+                                release_block( old, alloc );
+                                return;
+                        }
+
+                        /**
+                        * @brief deallocating child nodes (only dropping the reference if they are shared).
+                        * @param[in] alloc allocator of child nodes
+                        */
+                        void remove_child( allocator_type& alloc ) {
+                                if ( !this->is_leaf() ) {
+                                        release_block( this->_child & ~TAG_MASK, alloc );
+                                        this->_child = 0;
+                                }
+                                return;
+                        }
+
+                        /**
+                        * @brief drop a reference to a block and deallocate it with its subtree when it was the last one.
+                        */
+                        static void release_block( const handle h, allocator_type& alloc ) {
+                                if ( alloc.resolve(h)->_refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) destroy_block( h, alloc );
+                                return;
+                        }
+
+                        /**
+                        * @brief deallocate a block which is no longer referenced.
+                        */
+                        static void destroy_block( const handle h, allocator_type& alloc ) {
+                                node<U>* child = alloc.resolve(h)->child;
+                                for ( int i = 0 ; i < 8 ; ++i ) {
+                                        child[i].remove_child(alloc);
+                                }
+                                alloc.deallocate(h);
+                                return;
+                        }
+                };
+
+                /**
+                * @brief block of 8 child nodes and cached statistics of their parent.
+                */
+                struct block : public Statistics::template storage<T> {
+                        node<T> child[8];
+                        std::atomic<uint32_t> _refs; ///< The number of nodes (of the octree and its snapshots) pointing to the block.
+                        block ( void ) : _refs(1) {
+                                return;
+                        }
+                };
+
+                /**
+                * @brief state shared by an octree and its snapshots.
+                */
+                struct shared_state {
+                        typename node<T>::allocator_type allocator; ///< Allocator of child nodes.
+                        std::mutex mutex;                 ///< Guards garbage and owner.
+                        std::vector<typename node<T>::handle> garbage; ///< Blocks released by snapshots while the octree is alive.
+                        std::atomic<bool> pending;        ///< garbage is not empty.
+                        bool owner;                       ///< The writable octree is alive.
+                        std::atomic<size_t> snapshots;    ///< The number of live snapshots.
+                        shared_state ( void ) : pending(false), owner(true), snapshots(0) {
+                                return;
+                        }
+                };
+                struct snapshot_tag {};
+
+                typedef std::integral_constant<bool, Statistics::enabled> statistics_enabled;
+
+        private:
+                unsigned char   _level; ///< Maximum level of the octree.
+                int		_dimension; ///< Size of the octree.
+                T		_emptyValue; ///< Empty value of the octree.
+                node<T>*	_root; ///< A pointer to root pointer.
+                std::shared_ptr<shared_state> _shared; ///< Allocator of child nodes and garbage, shared with snapshots.
+                size_t          _generation; ///< Incremented whenever nodes may be removed.
+                bool            _snapshot; ///< The octree is a read-only snapshot.
+                std::vector<uint64_t> _dirty; ///< Morton codes of the cells changed since the last write_delta().
+                size_t          _dirtyLimit; ///< _dirty is sorted and made unique when it reaches this size.
+                unsigned char   _journalLevel; ///< Level of the cells in _dirty.
+                bool            _journal; ///< Changes are tracked (see track_changes()).
+                bool            _journalAll; ///< The whole octree has changed.
+                T            (*_reduce)( const T* ); ///< Reduction into intermediate nodes (NULL : no LOD values, see enable_lod()).
+	private:
+		octree ( const octree& that);
+		void operator = ( const octree& that);
+        public:
+                static unsigned char const MAX_LEVEL = 21; ///< 3 * 21 bits fit in a 64-bit Morton code and voxel count.
+
+                /**
+                * @struct leaf
+                * @brief A homogeneous cube (x, y, z) - (x + size - 1, y + size - 1, z + size - 1).
+                */
+                struct leaf {
+                        int x;    ///< x-coordinate of the origin
+                        int y;    ///< y-coordinate of the origin
+                        int z;    ///< z-coordinate of the origin
+                        int size; ///< Edge length of the cube
+                        T value;  ///< Value of all voxels in the cube
+                };
+
+                /**
+                * @struct ray_hit
+                * @brief The first non-empty voxel along a ray.
+                */
+                struct ray_hit {
+                        bool found; ///< The ray hits a non-empty voxel or not.
+                        int x;      ///< x-coordinate of the voxel
+                        int y;      ///< y-coordinate of the voxel
+                        int z;      ///< z-coordinate of the voxel
+                        double t;   ///< Ray parameter where the ray enters the voxel
+                        T value;    ///< Value of the voxel
+                };
+
+                /**
+                * @struct voxel
+                * @brief A voxel and its value.
+                */
+                struct voxel {
+                        int x;   ///< x-coordinate
+                        int y;   ///< y-coordinate
+                        int z;   ///< z-coordinate
+                        T value; ///< Value of the voxel
+                };
+
+                /**
+                * @brief Built-in operations of combine(). "Empty" refers to the empty value of each operand.
+                */
+                enum combine_op {
+                        UNION,        ///< a where a is not empty, b where only b is not empty.
+                        INTERSECTION, ///< a where both a and b are not empty.
+                        DIFFERENCE,   ///< a where a is not empty and b is empty.
+                        MINIMUM,      ///< the smaller of a and b (T must support operator<).
+                        MAXIMUM       ///< the larger of a and b (T must support operator<).
+                };
+
+                /**
+                * @struct profile
+                * @brief Shape and memory of an octree (see get_profile()).
+                */
+                struct profile {
+                        size_t nodes;     ///< The number of nodes (the root, intermediate nodes and leaves).
+                        size_t leaves;    ///< The number of leaves.
+                        size_t depth[32]; ///< depth[d] : the number of leaves at depth d (0 : the root).
+                        size_t bytes;     ///< bytes_used().
+                        size_t splits;    ///< Leaves split into 8 child nodes (counted with MI_OCTREE_PROFILE only).
+                        size_t merges;    ///< Subtrees replaced by a leaf (counted with MI_OCTREE_PROFILE only).
+                };
+
+                /**
+                * @brief reduction of the values of 8 child nodes (in child index order) into their parent.
+                * @see enable_lod()
+                */
+                typedef T (*reduce_function)( const T* values );
+
+                /**
+                * @brief the mean of 8 values (T must convert to and from double).
+                */
+                static T lod_mean ( const T* values ) {
+                        double sum = 0;
+                        for ( int i = 0 ; i < 8 ; ++i ) sum += static_cast<double>( values[i] );
+                        return static_cast<T>( sum / 8 );
+                }
+
+                /**
+                * @brief the largest of 8 values (T must support operator<).
+                */
+                static T lod_max ( const T* values ) {
+                        T result = values[0];
+                        for ( int i = 1 ; i < 8 ; ++i ) {
+                                if ( result < values[i] ) result = values[i];
+                        }
+                        return result;
+                }
+
+                /**
+                * @brief bitwise or of 8 values (e.g. occupancy flags).
+                */
+                static T lod_or ( const T* values ) {
+                        T result = values[0];
+                        for ( int i = 1 ; i < 8 ; ++i ) result = static_cast<T>( result | values[i] );
+                        return result;
+                }
+
+                /**
+                * @class leaf_iterator
+                * @brief Visits the leaves of an octree in depth-first order without recursion.
+                * @code
+                * for ( mi::octree<int>::leaf_iterator it = tree.leaf_begin(true) ; it != tree.leaf_end() ; ++it ) {
+                *     std::cout<<it->x<<" "<<it->y<<" "<<it->z<<" "<<it->size<<" "<<it->value<<std::endl;
+                * }
+                * @endcode
+                * @note Modifying the octree invalidates iterators.
+                */
+                class leaf_iterator
+                {
+                private:
+                        struct frame {
+                                const node<T>* nd;
+                                unsigned char level;
+                                int ox, oy, oz;
+                                int next; ///< Index of the next child to visit.
+                        };
+                        const octree*   _tree;      ///< The octree (NULL : end).
+                        bool            _skipEmpty; ///< Skip leaves with the empty value.
+                        frame           _stack[32]; ///< Intermediate nodes on the current path.
+                        int             _depth;     ///< The number of frames.
+                        leaf            _leaf;      ///< Current leaf.
+                public:
+                        /**
+                        * @brief Construct the end iterator.
+                        */
+                        leaf_iterator ( void ) : _tree(NULL), _skipEmpty(false), _depth(0) {
+                                return;
+                        }
+
+                        /**
+                        * @param[in] tree the octree
+                        * @param[in] skipEmpty skip leaves with the empty value or not
+                        */
+                        leaf_iterator ( const octree& tree, const bool skipEmpty ) : _tree(&tree), _skipEmpty(skipEmpty), _depth(0) {
+                                const node<T>& root = *(tree._root);
+                                if ( root.is_leaf() ) {
+                                        this->set_leaf( root, tree._level, 0, 0, 0 );
+                                        if ( skipEmpty && root.value() == tree._emptyValue ) this->_tree = NULL;
+                                        return;
+                                }
+                                this->push( root, tree._level, 0, 0, 0 );
+                                this->advance();
+                                return;
+                        }
+
+                        const leaf& operator * ( void ) const {
+                                return this->_leaf;
+                        }
+
+                        const leaf* operator -> ( void ) const {
+                                return &(this->_leaf);
+                        }
+
+                        leaf_iterator& operator ++ ( void ) {
+                                this->advance();
+                                return *this;
+                        }
+
+                        /**
+                        * @note Iterators are equal only if both are end iterators or the same object.
+                        */
+                        bool operator == ( const leaf_iterator& that ) const {
+                                return this == &that || ( this->_tree == NULL && that._tree == NULL );
+                        }
+
+                        bool operator != ( const leaf_iterator& that ) const {
+                                return !( *this == that );
+                        }
+                private:
+                        void push ( const node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz ) {
+                                frame& f = this->_stack[this->_depth++];
+                                f.nd = &nd;
+                                f.level = level;
+                                f.ox = ox;
+                                f.oy = oy;
+                                f.oz = oz;
+                                f.next = 0;
+                                return;
+                        }
+
+                        void set_leaf ( const node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz ) {
+                                this->_leaf.x = ox;
+                                this->_leaf.y = oy;
+                                this->_leaf.z = oz;
+                                this->_leaf.size = 1 << level;
+                                this->_leaf.value = nd.value();
+                                return;
+                        }
+
+                        void advance ( void ) {
+                                while ( this->_depth > 0 ) {
+                                        frame& f = this->_stack[this->_depth - 1];
+                                        if ( f.next == 8 ) {
+                                                --this->_depth;
+                                                continue;
+                                        }
+                                        const int i = f.next++;
+                                        const node<T>& child = f.nd->children( this->_tree->_shared->allocator )[i];
+                                        const int d = 1 << ( f.level - 1 );
+                                        const int ox = f.ox + d * ( i & 1 );
+                                        const int oy = f.oy + d * ( ( i >> 1 ) & 1 );
+                                        const int oz = f.oz + d * ( ( i >> 2 ) & 1 );
+                                        if ( child.is_leaf() ) {
+                                                if ( this->_skipEmpty && child.value() == this->_tree->_emptyValue ) continue;
+                                                this->set_leaf( child, f.level - 1, ox, oy, oz );
+                                                return;
+                                        }
+                                        if ( this->_skipEmpty && this->_tree->is_empty_subtree( child, f.level - 1 ) ) continue;
+                                        this->push( child, f.level - 1, ox, oy, oz );
+                                }
+                                this->_tree = NULL;
+                                return;
+                        }
+                };
+
+                /**
+                * @param[in] skipEmpty skip leaves with the empty value or not
+                * @return an iterator to the first leaf.
+                */
+                leaf_iterator leaf_begin ( const bool skipEmpty = false ) const {
+                        return leaf_iterator( *this, skipEmpty );
+                }
+
+                /**
+                * @return the end iterator.
+                */
+                leaf_iterator leaf_end ( void ) const {
+                        return leaf_iterator();
+                }
+
+                /**
+                * @brief call func for every leaf using a pool of threads.
+                *
+                * Subtrees under the top 2 levels are distributed to threads.
+                * @param[in] func called as func(const leaf&) from several threads at once.
+                * @param[in] skipEmpty skip leaves with the empty value or not
+                * @param[in] threads the number of threads (0 : hardware concurrency)
+                */
+                template < typename Function >
+                void parallel_for_each_leaf ( Function func, const bool skipEmpty = false, unsigned int threads = 0 ) const {
+                        if ( threads == 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+                        const unsigned char split = ( threads > 1 ) ? std::min<unsigned char>( this->_level, 2 ) : 0;
+                        std::vector<subtree> tasks;
+                        this->collect_leaf_tasks( *(this->_root), this->_level, 0, 0, 0, split, tasks );
+                        std::atomic<size_t> next(0);
+
+                        auto worker = [&] ( void ) {
+                                for ( size_t t = next++ ; t < tasks.size() ; t = next++ ) {
+                                        const subtree& s = tasks[t];
+                                        this->for_each_leaf_node( *(s.nd), s.level, s.ox, s.oy, s.oz, skipEmpty, func );
+                                }
+                        };
+                        std::vector<std::thread> pool;
+                        for ( unsigned int i = 1 ; i < threads && i < tasks.size() ; ++i ) pool.push_back( std::thread(worker) );
+                        worker();
+                        for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+                        return;
+                }
+
+                /**
+                * @class accessor
+                * @brief Caches the path to the last visited leaf.
+                *
+                * A query restarts from the lowest cached ancestor containing both
+                * the last point and the new one, so sweeps over adjacent voxels
+                * do not walk from the root every time.
+                * @code
+                * mi::octree<int>::accessor acc(tree);
+                * for ( int x = 0 ; x < tree.getDimension() ; ++x ) sum += acc.get(x, y, z);
+                * for ( int x = 0 ; x < tree.getDimension() ; ++x ) acc.set(x, y, z, 1);
+                * @endcode
+                * @note set() never removes nodes, so the cache survives it. fill_box(),
+                * optimize(), read() and init() remove nodes, and the next get() then
+                * starts from the root again. While snapshots are alive, every set()
+                * starts from the root because shared paths are copied. An accessor
+                * must not be shared by threads.
+                */
+                class accessor
+                {
+                private:
+                        const octree*   _tree;       ///< The octree.
+                        octree*         _writable;   ///< The octree if it may be modified by set() (NULL : read only).
+                        size_t          _generation; ///< Generation of the octree when the cache was filled.
+                        node<T>*        _path[32];   ///< _path[l] is the node at level l (valid for l >= _leafLevel).
+                        unsigned char   _leafLevel;  ///< Level of the last leaf.
+                        int             _x, _y, _z;  ///< The last point.
+                public:
+                        /**
+                        * @param[in] tree the octree
+                        * @note set() does nothing on an accessor of a const octree.
+                        */
+                        explicit accessor ( const octree& tree ) : _tree(&tree), _writable(NULL), _generation(0), _leafLevel(0), _x(0), _y(0), _z(0) {
+                                this->reset();
+                                return;
+                        }
+
+                        /**
+                        * @param[in] tree the octree
+                        */
+                        explicit accessor ( octree& tree ) : _tree(&tree), _writable(&tree), _generation(0), _leafLevel(0), _x(0), _y(0), _z(0) {
+                                this->reset();
+                                return;
+                        }
+
+                        /**
+                        * @brief forget the cached path.
+                        */
+                        void reset ( void ) {
+                                this->_generation = this->_tree->_generation - 1;
+                                return;
+                        }
+
+                        /**
+                        * @brief get value at (x, y, z)
+                        * @param[in] x x-coordinate
+                        * @param[in] y y-coordinate
+                        * @param[in] z z-coordinate
+                        * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                        */
+                        T get ( const int x, const int y, const int z ) {
+                                const octree& tree = *(this->_tree);
+                                if ( !tree.is_valid(x, y, z) ) return tree._emptyValue;
+                                unsigned char l = this->restart_level(x, y, z);
+                                const node<T>* nd = this->_path[l];
+                                while ( !nd->is_leaf() ) {
+                                        --l;
+                                        this->_path[l] = nd->children( tree._shared->allocator ) + node<T>::child_index(x, y, z, l);
+                                        nd = this->_path[l];
+                                }
+                                this->_leafLevel = l;
+                                return nd->value();
+                        }
+
+                        /**
+                        * @brief set value at (x, y, z)
+                        * @param[in] x x-coordinate
+                        * @param[in] y y-coordinate
+                        * @param[in] z z-coordinate
+                        * @param[in] v value
+                        * @note do nothing if (x,y,z) is invalid or the accessor was made from a const octree.
+                        */
+                        void set ( const int x, const int y, const int z, const T& v ) {
+                                this->set_leaf( x, y, z, v );
+                                return;
+                        }
+
+                        /**
+                        * @brief set value at (x, y, z) by moving v into the leaf.
+                        * @param[in] x x-coordinate
+                        * @param[in] y y-coordinate
+                        * @param[in] z z-coordinate
+                        * @param[in] v value (moved)
+                        * @note do nothing if (x,y,z) is invalid or the accessor was made from a const octree.
+                        */
+                        void set ( const int x, const int y, const int z, T&& v ) {
+                                this->set_leaf( x, y, z, std::move(v) );
+                                return;
+                        }
+                private:
+                        /**
+                        * @brief remember (x, y, z) and get the level of the lowest cached ancestor containing it.
+                        */
+                        unsigned char restart_level ( const int x, const int y, const int z ) {
+                                const octree& tree = *(this->_tree);
+                                unsigned char l = tree._level;
+                                if ( this->_generation == tree._generation ) {
+                                        const unsigned int diff = static_cast<unsigned int>( ( x ^ this->_x ) | ( y ^ this->_y ) | ( z ^ this->_z ) );
+                                        l = this->_leafLevel;
+                                        while ( ( diff >> l ) != 0 ) ++l;
+                                } else {
+                                        this->_path[l] = tree._root;
+                                        this->_generation = tree._generation;
+                                }
+                                this->_x = x;
+                                this->_y = y;
+                                this->_z = z;
+                                return l;
+                        }
+
+                        /**
+                        * @brief split nodes below the lowest cached ancestor down to the voxel and set its value.
+                        */
+                        template < typename V >
+                        void set_leaf ( const int x, const int y, const int z, V&& v ) {
+                                if ( this->_writable == NULL ) return;
+                                octree& tree = *(this->_writable);
+                                tree.prepare_write();
+                                if ( !tree.is_valid(x, y, z) ) return;
+                                if ( tree._journal ) tree.mark_dirty(x, y, z);
+                                unsigned char l = this->restart_level(x, y, z);
+                                node<T>* nd = this->_path[l];
+                                while ( l > 0 ) {
+                                        nd->create_child( tree._shared->allocator );
+                                        --l;
+                                        this->_path[l] = nd->children( tree._shared->allocator ) + node<T>::child_index(x, y, z, l);
+                                        nd = this->_path[l];
+                                }
+                                nd->set_value( std::forward<V>(v) );
+                                this->_leafLevel = 0;
+                                tree.update_path( this->_path, 1, tree._level + 1 );
+                                return;
+                        }
+                };
+
+                /**
+                * @brief Default constructor.
+                *
+                */
+                octree ( void ) : _shared( new shared_state() ), _snapshot(false),
+                          _dirtyLimit(0), _journalLevel(0), _journal(false), _journalAll(false), _reduce(NULL) {
+                        this->_generation = 0;
+                        this->_level = 0;
+                        this->_dimension = 0;
+                        this->_root = NULL;
+                }
+                /**
+                * @param[in] dimension dimension of the octree
+                * @param[in] emptyValue the default value of the octree
+                */
+                octree ( const int dimension, const T& emptyValue = T()) : _shared( new shared_state() ), _snapshot(false),
+                          _dirtyLimit(0), _journalLevel(0), _journal(false), _journalAll(false), _reduce(NULL) {
+                        this->_generation = 0;
+                        this->_root = NULL;
+                        this->init(dimension, emptyValue);
+                        return;
+                }
+
+                /**
+                * @brief Construct from a dense voxel array.
+                * @param[in] data voxel values. The value at (x, y, z) is data[x + nx * ( y + ny * z )].
+                * @param[in] nx the number of voxels along x-axis
+                * @param[in] ny the number of voxels along y-axis
+                * @param[in] nz the number of voxels along z-axis
+                * @param[in] emptyValue the default value of the octree
+                * @param[in] threads the number of threads (0 : hardware concurrency)
+                * @see build_from_dense()
+                */
+                octree ( const T* data, const int nx, const int ny, const int nz, const T& emptyValue = T(), const unsigned int threads = 0 )
+                        : _shared( new shared_state() ), _snapshot(false),
+                          _dirtyLimit(0), _journalLevel(0), _journal(false), _journalAll(false), _reduce(NULL) {
+                        this->_generation = 0;
+                        this->_root = NULL;
+                        this->build_from_dense(data, nx, ny, nz, emptyValue, threads);
+                        return;
+                }
+
+                /**
+                * @brief Move constructor. The nodes are taken over without copying.
+                * @param[in] that the moved octree. It is left empty (getDimension() == 0) and can be init()ed again.
+                * @note accessors and iterators of that must not be used afterwards. Snapshots stay valid.
+                * Nothing is allocated; that gets a new allocator when it is init()ed.
+                */
+                octree ( octree&& that ) noexcept( std::is_nothrow_move_constructible<T>::value )
+                        : _level( that._level ), _dimension( that._dimension ), _emptyValue( std::move( that._emptyValue ) ), _root( that._root ),
+                          _shared( std::move( that._shared ) ), _generation( that._generation ), _snapshot( that._snapshot ),
+                          _dirty( std::move( that._dirty ) ), _dirtyLimit( that._dirtyLimit ), _journalLevel( that._journalLevel ),
+                          _journal( that._journal ), _journalAll( that._journalAll ), _reduce( that._reduce ) {
+                        that.reset_moved();
+                        return;
+                }
+
+                /**
+                * @brief Destructor
+                */
+                virtual ~octree ( void ) {
+                        this->destroy();
+                        return;
+                }
+
+                /**
+                * @brief Move assignment. The nodes of this octree are released and those of that are taken over.
+                * @param[in] that the moved octree. It is left empty (getDimension() == 0) and can be init()ed again.
+                * @return this octree.
+                * @note accessors and iterators of both octrees must not be used afterwards. Snapshots stay valid.
+                * Nothing is allocated; that gets a new allocator when it is init()ed.
+                */
+                octree& operator = ( octree&& that ) noexcept( std::is_nothrow_move_assignable<T>::value ) {
+                        if ( this == &that ) return *this;
+                        this->destroy();
+                        this->_level        = that._level;
+                        this->_dimension    = that._dimension;
+                        this->_emptyValue   = std::move( that._emptyValue );
+                        this->_root         = that._root;
+                        this->_shared       = std::move( that._shared );
+                        this->_generation   = that._generation + 1;
+                        this->_snapshot     = that._snapshot;
+                        this->_dirty        = std::move( that._dirty );
+                        this->_dirtyLimit   = that._dirtyLimit;
+                        this->_journalLevel = that._journalLevel;
+                        this->_journal      = that._journal;
+                        this->_journalAll   = that._journalAll;
+                        this->_reduce       = that._reduce;
+                        that.reset_moved();
+                        return *this;
+                }
+
+                /**
+                * @brief take a read-only snapshot of the octree in O(1).
+                *
+                * The snapshot shares all child blocks with the octree. A later set(),
+                * set_batch() or fill_box() copies only the blocks on the modified paths,
+                * and optimize() leaves shared subtrees as they are. The snapshot can be
+                * read (and released) by other threads while this octree is written.
+                * @return the snapshot. It stays valid after the octree is destroyed.
+                * @note Reading a snapshot concurrently with writes requires an allocator
+                * whose resolve() does not depend on its own state (new_allocator, pool_allocator);
+                * compact_allocator looks handles up in a growing chunk table.
+                */
+                std::shared_ptr<const octree> snapshot ( void ) const {
+                        return std::shared_ptr<const octree>( new octree( *this, snapshot_tag() ) );
+                }
+                /**
+                * @param[in] dimension dimension of the octree
+                * @param[in] emptyValue the default value of the octree
+                * @note The dimension is clamped to 2^MAX_LEVEL.
+                */
+                void init(const int dimension, const T& emptyValue) {
+                        this->_emptyValue = emptyValue; // before release() as emptyValue may be a node's value.
+                        this->release();
+                        if ( this->_shared == NULL ) this->_shared.reset( new shared_state() ); // moved out.
+                        this->_level      = this->get_level(dimension);
+                        this->_dimension  = 1 << this->_level;
+                        this->_root = new node<T>( this->_emptyValue );
+                        if ( this->_journal ) this->_journalAll = true;
+                        return;
+                }
+
+                /**
+                * @brief make all voxels emptyValue, keeping the dimension and the memory.
+                *
+                * Unlike init(), the root is reused and pool_allocator and compact_allocator
+                * keep their chunks, so refilling the octree does not allocate again until
+                * it grows beyond its previous size. With new_allocator (or a value type with
+                * a destructor) the blocks are still freed one by one.
+                * @param[in] emptyValue the default value of the octree
+                */
+                void clear ( const T& emptyValue ) {
+                        if ( this->_root == NULL ) return;
+                        this->_emptyValue = emptyValue;
+                        ++this->_generation;
+                        const bool shared = this->has_snapshots();
+                        this->collect_garbage();
+                        if ( shared || !node<T>::allocator_type::bulk_release || !std::is_trivially_destructible<T>::value ) {
+                                this->_root->remove_child( this->_shared->allocator );
+                        }
+                        if ( !shared ) this->_shared->allocator.reset();
+                        *(this->_root) = node<T>( this->_emptyValue );
+                        if ( this->_journal ) this->_journalAll = true;
+                        return;
+                }
+
+                /**
+                * @brief build the octree from a dense voxel array.
+                *
+                * The tree is built bottom-up, so uniform 2x2x2 blocks are merged before
+                * their parent is allocated. The subtrees under the top 2 levels are
+                * built by a pool of threads.
+                * @param[in] data voxel values. The value at (x, y, z) is data[x + nx * ( y + ny * z )].
+                * @param[in] nx the number of voxels along x-axis
+                * @param[in] ny the number of voxels along y-axis
+                * @param[in] nz the number of voxels along z-axis
+                * @param[in] emptyValue the default value of the octree
+                * @param[in] threads the number of threads (0 : hardware concurrency)
+                * @note Voxels outside the array become emptyValue.
+                */
+                void build_from_dense ( const T* data, const int nx, const int ny, const int nz, const T& emptyValue = T(), unsigned int threads = 0 ) {
+                        this->init( std::max( nx, std::max( ny, nz ) ), emptyValue );
+                        if ( threads == 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+                        const dense_array src = { data, nx, ny, nz };
+                        const unsigned char split = ( threads > 1 ) ? std::min<unsigned char>( this->_level, 2 ) : 0;
+                        const size_t tasks = size_t(1) << ( 3 * split );
+                        const unsigned char task_level = this->_level - split;
+                        std::vector< node<T> > results( tasks );
+                        std::atomic<size_t> next(0);
+                        std::mutex mutex;
+                        const bool deferred = block_source::defer_statistics( threads );
+
+                        auto worker = [&] ( void ) {
+                                block_source blocks( this->_shared->allocator, mutex, deferred );
+                                for ( size_t t = next++ ; t < tasks ; t = next++ ) {
+                                        int ox = 0, oy = 0, oz = 0;
+                                        for ( unsigned char k = 0 ; k < split ; ++k ) {
+                                                const size_t id = ( t >> ( 3 * ( split - 1 - k ) ) ) & 7;
+                                                const int d = 1 << ( this->_level - 1 - k );
+                                                ox += static_cast<int>( id & 1 ) * d;
+                                                oy += static_cast<int>( ( id >> 1 ) & 1 ) * d;
+                                                oz += static_cast<int>( ( id >> 2 ) & 1 ) * d;
+                                        }
+                                        this->build_dense_node( results[t], task_level, ox, oy, oz, src, blocks );
+                                }
+                        };
+                        std::vector<std::thread> pool;
+                        for ( unsigned int i = 1 ; i < threads && i < tasks ; ++i ) pool.push_back( std::thread(worker) );
+                        worker();
+                        for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+
+                        block_source blocks( this->_shared->allocator, mutex );
+                        if ( deferred ) this->update_results( results, task_level, threads );
+                        this->assemble_dense_node( *(this->_root), this->_level, split, 0, results, blocks );
+                        this->reduce_node( *(this->_root), true );
+                        return;
+                }
+
+                /**
+                * @brief get value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                */
+                T get (const int x, const int y, const int z) const {
+                        return this->is_valid(x,y,z) ?
+                               this->_root->get( this->_level, x, y, z, this->_shared->allocator ) : this->_emptyValue;
+                }
+
+                /**
+                * @brief set value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[in] v value
+                * @note do nothing if (x,y,z) is invalid.
+                */
+                void set (const int x, const int y, const int z, const T& v) {
+                        this->prepare_write();
+                        if ( this->is_valid(x,y,z) ) {
+                                if ( this->_journal ) this->mark_dirty(x, y, z);
+                                this->set_node( x, y, z, v, statistics_enabled() );
+                        }
+                        return;
+                }
+
+                /**
+                * @brief set value at (x, y, z) by moving v into the leaf.
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[in] v value (moved)
+                * @note do nothing if (x,y,z) is invalid.
+                */
+                void set (const int x, const int y, const int z, T&& v) {
+                        this->prepare_write();
+                        if ( this->is_valid(x,y,z) ) {
+                                if ( this->_journal ) this->mark_dirty(x, y, z);
+                                this->set_node( x, y, z, std::move(v), statistics_enabled() );
+                        }
+                        return;
+                }
+
+                /**
+                * @brief get values at many points at once.
+                *
+                * The points are processed in Morton order, and each descent restarts
+                * from the deepest node shared with the previous point.
+                * @param[in] xyz coordinates (x0, y0, z0, x1, y1, z1, ...)
+                * @param[in] n the number of points
+                * @param[out] out values (n elements). Invalid points get the empty value.
+                */
+                void get_batch ( const int* xyz, const size_t n, T* out ) const {
+                        std::vector< std::pair<uint64_t, size_t> > order;
+                        order.reserve(n);
+                        for ( size_t i = 0 ; i < n ; ++i ) {
+                                const int* p = xyz + 3 * i;
+                                if ( this->is_valid(p[0], p[1], p[2]) ) order.push_back( std::make_pair( morton_code::encode(p[0], p[1], p[2]), i ) );
+                                else out[i] = this->_emptyValue;
+                        }
+                        std::sort(order.begin(), order.end());
+
+                        const node<T>* path[MAX_MORTON_LEVEL + 1];
+                        path[this->_level] = this->_root;
+                        unsigned char reached = this->_level;
+                        for ( size_t k = 0 ; k < order.size() ; ++k ) {
+                                const uint64_t key = order[k].first;
+                                unsigned char l = this->_level;
+                                if ( k > 0 ) l = restart_level(order[k-1].first, key, reached);
+                                const node<T>* nd = path[l];
+                                while ( !nd->is_leaf() ) {
+                                        --l;
+                                        nd = nd->children(this->_shared->allocator) + ( ( key >> ( 3 * l ) ) & 7 );
+                                        path[l] = nd;
+                                }
+                                reached = l;
+                                out[order[k].second] = nd->value();
+                        }
+                        return;
+                }
+
+                /**
+                * @brief set values at many points at once.
+                *
+                * Same as calling set() for each point in order. The points are
+                * processed in Morton order, sharing path prefixes as get_batch().
+                * @param[in] xyz coordinates (x0, y0, z0, x1, y1, z1, ...)
+                * @param[in] n the number of points
+                * @param[in] values values (n elements)
+                * @note invalid points are ignored.
+                */
+                void set_batch ( const int* xyz, const size_t n, const T* values ) {
+                        this->prepare_write();
+                        std::vector< std::pair<uint64_t, size_t> > order;
+                        order.reserve(n);
+                        for ( size_t i = 0 ; i < n ; ++i ) {
+                                const int* p = xyz + 3 * i;
+                                if ( !this->is_valid(p[0], p[1], p[2]) ) continue;
+                                order.push_back( std::make_pair( morton_code::encode(p[0], p[1], p[2]), i ) );
+                                if ( this->_journal ) this->mark_dirty(p[0], p[1], p[2]);
+                        }
+                        std::sort(order.begin(), order.end()); // the last one wins among duplicates.
+
+                        node<T>* path[MAX_MORTON_LEVEL + 1];
+                        path[this->_level] = this->_root;
+                        for ( size_t k = 0 ; k < order.size() ; ++k ) {
+                                const uint64_t key = order[k].first;
+                                unsigned char l = this->_level;
+                                if ( k > 0 ) l = restart_level(order[k-1].first, key, 0);
+                                if ( k > 0 ) this->update_path( path, 1, l );
+                                node<T>* nd = path[l];
+                                while ( l > 0 ) {
+                                        nd->create_child(this->_shared->allocator);
+                                        --l;
+                                        nd = nd->children(this->_shared->allocator) + ( ( key >> ( 3 * l ) ) & 7 );
+                                        path[l] = nd;
+                                }
+                                nd->set_value(values[order[k].second]);
+                        }
+                        if ( !order.empty() ) this->update_path( path, 1, this->_level + 1 );
+                        return;
+                }
+
+                /**
+                * @brief check (x, y, z) is valid
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is valid
+                * @retval false (x, y, z) is invalid
+                */
+                bool is_valid (const int x, const int y, const int z) const {
+                        if ( x < 0 ) return false;
+                        if ( y < 0 ) return false;
+                        if ( z < 0 ) return false;
+                        if ( this->getDimension() <= x ) return false;
+                        if ( this->getDimension() <= y ) return false;
+                        if ( this->getDimension() <= z ) return false;
+                        return true;
+                }
+
+                /**
+                * @brief check (x, y, z) is empty
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is empty
+                * @retval false (x, y, z) is not empty
+                */
+                bool is_empty ( const int x, const int y, const int z) {
+                        return this->get(x, y, z) == this->_emptyValue;
+                }
+
+                /**
+                * @brief get bounding box (mnx, mny, mnz) - (mxx, mxy, mxz)
+                * @param[out] mnx minimum x-coordinate
+                * @param[out] mny minimum y-coordinate
+                * @param[out] mnz minimum z-coordinate
+                * @param[out] mxx maximum x-coordinate
+                * @param[out] mxy maximum y-coordinate
+                * @param[out] mxz maximum z-coordinate
+                * @param[in] optimized if true, get bounding box of non-empty cells
+                */
+                void boundingbox (int& mnx, int& mny, int& mnz,  int& mxx, int& mxy, int& mxz,              bool optimized = true) {
+                        if (optimized) {
+                                this->_root->boundingbox( this->_level, *this, mnx, mny, mnz, mxx, mxy, mxz);
+                        } else {
+                                mnx = mny = mnz = 0;
+                                mxx = mxy = mxz = this->_dimension - 1;
+                        }
+                        return;
+                }
+
+                /**
+                * @brief set value to all voxels in the box (mnx, mny, mnz) - (mxx, mxy, mxz).
+                *
+                * Subtrees inside the box are replaced by a single leaf at once.
+                * @param[in] mnx minimum x-coordinate
+                * @param[in] mny minimum y-coordinate
+                * @param[in] mnz minimum z-coordinate
+                * @param[in] mxx maximum x-coordinate
+                * @param[in] mxy maximum y-coordinate
+                * @param[in] mxz maximum z-coordinate
+                * @param[in] v value
+                * @note The box is clipped by the octree.
+                */
+                void fill_box ( const int mnx, const int mny, const int mnz, const int mxx, const int mxy, const int mxz, const T& v ) {
+                        const int box[6] = { mnx, mny, mnz, mxx, mxy, mxz };
+                        this->prepare_write();
+                        ++this->_generation;
+                        if ( this->_journal ) this->mark_box( box );
+                        this->fill_node( *(this->_root), this->_level, 0, 0, 0, box, v );
+                        return;
+                }
+
+                /**
+                * @brief visit all leaves intersecting the box (mnx, mny, mnz) - (mxx, mxy, mxz).
+                * @param[in] mnx minimum x-coordinate
+                * @param[in] mny minimum y-coordinate
+                * @param[in] mnz minimum z-coordinate
+                * @param[in] mxx maximum x-coordinate
+                * @param[in] mxy maximum y-coordinate
+                * @param[in] mxz maximum z-coordinate
+                * @param[in] func called as func(x, y, z, size, value) for the leaf covering
+                * (x, y, z) - (x + size - 1, y + size - 1, z + size - 1).
+                * @note Leaves partially in the box are visited as a whole.
+                */
+                template < typename Function >
+                void for_each_in_box ( const int mnx, const int mny, const int mnz, const int mxx, const int mxy, const int mxz, Function func ) const {
+                        const int box[6] = { mnx, mny, mnz, mxx, mxy, mxz };
+                        this->for_each_node( *(this->_root), this->_level, 0, 0, 0, box, func );
+                        return;
+                }
+
+                /**
+                * @brief find the first non-empty voxel along a ray.
+                *
+                * The ray is o + t * d (0 <= t <= tmax) and voxel (x, y, z) is the unit cube
+                * [x, x+1) x [y, y+1) x [z, z+1). The traversal is a DDA over leaves, so a
+                * uniform empty leaf (and, with subtree_statistics, an empty subtree) is
+                * crossed in one step.
+                * @param[in] ox x-coordinate of the origin
+                * @param[in] oy y-coordinate of the origin
+                * @param[in] oz z-coordinate of the origin
+                * @param[in] dx x-component of the direction
+                * @param[in] dy y-component of the direction
+                * @param[in] dz z-component of the direction
+                * @param[in] tmax maximum parameter of the ray
+                * @param[out] hit the first non-empty voxel and the parameter where the ray enters it.
+                * @retval true The ray hits a non-empty voxel.
+                * @retval false The ray hits nothing.
+                * @note A ray through an edge or a corner shared by voxels enters only one of them.
+                */
+                bool raycast ( const double ox, const double oy, const double oz,
+                               const double dx, const double dy, const double dz, const double tmax, ray_hit& hit ) const {
+                        hit.found = false;
+                        const double o[3] = { ox, oy, oz };
+                        const double d[3] = { dx, dy, dz };
+                        const double size = this->_dimension;
+                        double inv[3];
+                        double t0 = 0, t1 = tmax;
+                        for ( int a = 0 ; a < 3 ; ++a ) {
+                                if ( d[a] == 0 ) {
+                                        if ( o[a] < 0 || size <= o[a] ) return false;
+                                        inv[a] = 0;
+                                        continue;
+                                }
+                                inv[a] = 1.0 / d[a];
+                                double ta = ( 0 - o[a] ) * inv[a];
+                                double tb = ( size - o[a] ) * inv[a];
+                                if ( tb < ta ) std::swap( ta, tb );
+                                t0 = std::max( t0, ta );
+                                t1 = std::min( t1, tb );
+                        }
+                        if ( t1 < t0 ) return false;
+
+                        int v[3];
+                        for ( int a = 0 ; a < 3 ; ++a ) v[a] = clamp_floor( o[a] + d[a] * t0, 0, this->_dimension - 1 );
+                        const node<T>* path[32];
+                        path[this->_level] = this->_root;
+                        unsigned char l = this->_level;
+                        double t = t0;
+                        for ( ; ; ) {
+                                const node<T>* nd = path[l];
+                                while ( !nd->is_leaf() && !this->is_empty_subtree( *nd, l ) ) {
+                                        --l;
+                                        nd = nd->children( this->_shared->allocator ) + node<T>::child_index( v[0], v[1], v[2], l );
+                                        path[l] = nd;
+                                }
+                                if ( nd->is_leaf() && nd->value() != this->_emptyValue ) {
+                                        hit.found = true;
+                                        hit.x = v[0];
+                                        hit.y = v[1];
+                                        hit.z = v[2];
+                                        hit.t = t;
+                                        hit.value = nd->value();
+                                        return true;
+                                }
+
+                                // leave the empty cube through the nearest face.
+                                const int s = 1 << l;
+                                int base[3];
+                                int axis = -1;
+                                double exit = t1;
+                                for ( int a = 0 ; a < 3 ; ++a ) {
+                                        base[a] = v[a] & ~( s - 1 );
+                                        if ( d[a] == 0 ) continue;
+                                        const double ta = ( ( d[a] > 0 ? base[a] + s : base[a] ) - o[a] ) * inv[a];
+                                        if ( ta <= exit ) {
+                                                exit = ta;
+                                                axis = a;
+                                        }
+                                }
+                                if ( axis < 0 ) return false;
+                                int next[3];
+                                for ( int a = 0 ; a < 3 ; ++a ) {
+                                        if ( a == axis ) next[a] = ( d[a] > 0 ) ? base[a] + s : base[a] - 1;
+                                        else next[a] = clamp_floor( o[a] + d[a] * exit, base[a], base[a] + s - 1 );
+                                }
+                                if ( next[axis] < 0 || this->_dimension <= next[axis] ) return false;
+
+                                const unsigned int diff = static_cast<unsigned int>( ( next[0] ^ v[0] ) | ( next[1] ^ v[1] ) | ( next[2] ^ v[2] ) );
+                                while ( ( diff >> l ) != 0 ) ++l;
+                                v[0] = next[0];
+                                v[1] = next[1];
+                                v[2] = next[2];
+                                t = exit;
+                        }
+                }
+
+                /**
+                * @brief cast packets of rays with a pool of threads.
+                * @param[in] origins origins of rays (x0, y0, z0, x1, y1, z1, ...)
+                * @param[in] directions directions of rays (x0, y0, z0, x1, y1, z1, ...)
+                * @param[in] n the number of rays
+                * @param[in] tmax maximum parameter of the rays
+                * @param[out] hits results of rays. hits[i].found is false if ray i hits nothing.
+                * @param[in] threads the number of threads (0 : hardware concurrency)
+                * @return the number of rays which hit a non-empty voxel.
+                */
+                size_t raycast_batch ( const double* origins, const double* directions, const size_t n, const double tmax, ray_hit* hits, unsigned int threads = 0 ) const {
+                        if ( threads == 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+                        const size_t packet = 64;
+                        const size_t tasks = ( n + packet - 1 ) / packet;
+                        std::atomic<size_t> next(0);
+                        std::atomic<size_t> found(0);
+
+                        auto worker = [&] ( void ) {
+                                size_t count = 0;
+                                for ( size_t t = next++ ; t < tasks ; t = next++ ) {
+                                        const size_t end = std::min( n, ( t + 1 ) * packet );
+                                        for ( size_t i = t * packet ; i < end ; ++i ) {
+                                                const double* o = origins + 3 * i;
+                                                const double* d = directions + 3 * i;
+                                                if ( this->raycast( o[0], o[1], o[2], d[0], d[1], d[2], tmax, hits[i] ) ) ++count;
+                                        }
+                                }
+                                found += count;
+                        };
+                        std::vector<std::thread> pool;
+                        for ( unsigned int i = 1 ; i < threads && i < tasks ; ++i ) pool.push_back( std::thread(worker) );
+                        worker();
+                        for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+                        return found;
+                }
+
+                /**
+                * @brief find the non-empty voxel closest to (x, y, z).
+                *
+                * Subtrees are visited in the order of their distance to (x, y, z), so the
+                * search stops at the first non-empty leaf.
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[out] result the closest non-empty voxel (ties are broken arbitrarily).
+                * @retval true Found.
+                * @retval false The octree has no non-empty voxel.
+                * @note (x, y, z) may be outside the octree. Distances are Euclidean between voxel coordinates.
+                */
+                bool nearest ( const int x, const int y, const int z, voxel& result ) const {
+                        std::priority_queue< candidate, std::vector<candidate>, std::greater<candidate> > queue;
+                        const candidate root = { cube_distance2( x, y, z, 0, 0, 0, this->_dimension ), this->_root, this->_level, 0, 0, 0 };
+                        queue.push( root );
+                        while ( !queue.empty() ) {
+                                const candidate c = queue.top();
+                                queue.pop();
+                                if ( c.nd->is_leaf() ) {
+                                        if ( c.nd->value() == this->_emptyValue ) continue;
+                                        const int s = 1 << c.level;
+                                        result.x = std::max( c.ox, std::min( x, c.ox + s - 1 ) );
+                                        result.y = std::max( c.oy, std::min( y, c.oy + s - 1 ) );
+                                        result.z = std::max( c.oz, std::min( z, c.oz + s - 1 ) );
+                                        result.value = c.nd->value();
+                                        return true;
+                                }
+                                if ( this->is_empty_subtree( *(c.nd), c.level ) ) continue;
+                                const node<T>* child = c.nd->children( this->_shared->allocator );
+                                const int d = 1 << ( c.level - 1 );
+                                for ( int i = 0 ; i < 8 ; ++i ) {
+                                        const int ox = c.ox + d * ( i & 1 );
+                                        const int oy = c.oy + d * ( ( i >> 1 ) & 1 );
+                                        const int oz = c.oz + d * ( ( i >> 2 ) & 1 );
+                                        if ( child[i].is_leaf() && child[i].value() == this->_emptyValue ) continue;
+                                        const candidate next = { cube_distance2( x, y, z, ox, oy, oz, d ), &child[i], static_cast<unsigned char>( c.level - 1 ), ox, oy, oz };
+                                        queue.push( next );
+                                }
+                        }
+                        return false;
+                }
+
+                /**
+                * @brief get all non-empty voxels within a sphere.
+                * @param[in] x x-coordinate of the center
+                * @param[in] y y-coordinate of the center
+                * @param[in] z z-coordinate of the center
+                * @param[in] r radius
+                * @param[out] out the voxels are appended in no particular order.
+                * @return the number of appended voxels.
+                */
+                size_t radius_query ( const int x, const int y, const int z, const double r, std::vector<voxel>& out ) const {
+                        const size_t size = out.size();
+                        if ( r < 0 ) return 0;
+                        this->radius_node( *(this->_root), this->_level, 0, 0, 0, x, y, z, r * r, out );
+                        return out.size() - size;
+                }
+
+                /**
+                * @param[in] value The value which you count.
+                * @return the nuber of voxels with the value.
+                * @note O(1) for the empty value if statistics are cached. Otherwise
+                * subtrees whose cached range excludes the value are skipped.
+                * The total of 8^MAX_LEVEL voxels fits in a 64-bit size_t.
+                */
+                size_t count( const T& value ) const {
+                        if ( value == this->_emptyValue ) {
+                                return ( size_t(1) << ( 3 * this->_level ) ) - this->count_nonempty();
+                        }
+                        return this->count_node( *(this->_root), this->_level, value );
+                }
+
+                /**
+                * @return the number of voxels which are not empty.
+                * @note O(1) if statistics are cached.
+                */
+                size_t count_nonempty( void ) const {
+                        return this->count_nonempty( statistics_enabled() );
+                }
+
+                /**
+                * @param[out] mn minimum value in the octree
+                * @param[out] mx maximum value in the octree
+                * @note O(1) if statistics are cached. T must support operator<.
+                */
+                void value_range( T& mn, T& mx ) const {
+                        uint64_t nonempty;
+                        this->get_statistics( *(this->_root), this->_level, nonempty, mn, mx, statistics_enabled() );
+                        return;
+                }
+
+                /**
+                * @brief merge every intermediate node whose 8 children are leaves with the same value.
+                *
+                * Subtrees under the top 2 levels are processed by a pool of threads.
+                * @param[in] opt optimized or not. if false, do nothing.
+                * @param[in] threads the number of threads (0 : hardware concurrency)
+                * @return the number of freed nodes.
+                */
+                size_t optimize ( const bool opt = true, unsigned int threads = 0 ) {
+                        if ( !opt ) return 0;
+                        this->prepare_write();
+                        ++this->_generation;
+                        if ( threads == 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+                        typedef typename node<T>::handle handle;
+
+                        const unsigned char split = ( threads > 1 ) ? std::min<unsigned char>( this->_level, 2 ) : 0;
+                        std::vector< node<T>* > tasks;
+                        this->collect_subtrees( *(this->_root), split, tasks );
+                        std::vector< std::vector<handle> > freed( tasks.size() );
+                        std::vector< size_t > counts( tasks.size(), 0 );
+                        std::atomic<size_t> next(0);
+
+                        auto worker = [&] ( void ) {
+                                for ( size_t t = next++ ; t < tasks.size() ; t = next++ ) {
+                                        counts[t] = tasks[t]->optimize( this->_shared->allocator, freed[t] );
+                                }
+                        };
+                        std::vector<std::thread> pool;
+                        for ( unsigned int i = 1 ; i < threads && i < tasks.size() ; ++i ) pool.push_back( std::thread(worker) );
+                        worker();
+                        for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+
+                        std::vector<handle> top;
+                        size_t count = this->optimize_top( *(this->_root), split, top );
+                        for ( size_t t = 0 ; t < tasks.size() ; ++t ) {
+                                count += counts[t];
+                                for ( size_t i = 0 ; i < freed[t].size() ; ++i ) this->_shared->allocator.deallocate( freed[t][i] );
+                        }
+                        for ( size_t i = 0 ; i < top.size() ; ++i ) this->_shared->allocator.deallocate( top[i] );
+                        return count;
+                }
+
+                /**
+                * @brief replace the octree by a voxel-wise combination of a and b.
+                *
+                * Both octrees are walked in lockstep. A uniform leaf on one side is
+                * combined with the nodes of the other side without descending to voxels,
+                * and is not visited further if it decides the result (e.g. an empty leaf
+                * of a in INTERSECTION). Where the result equals a subtree of an operand
+                * allocated by this octree (e.g. a.combine(a, b, UNION) outside b), the
+                * subtree is shared instead of copied. Subtrees under the top 2 levels are
+                * combined by a pool of threads. The empty value of the result is that of a.
+                * @param[in] a the first operand (may be this octree)
+                * @param[in] b the second operand (may be this octree)
+                * @param[in] op operation
+                * @param[in] threads the number of threads (0 : hardware concurrency)
+                * @retval true Succeeded.
+                * @retval false a and b have different dimensions or are not initialized.
+                * @note The octrees are combined by a single thread if a or b shares the allocator
+                * with this octree (itself or its snapshot), as the allocator may grow while it is read.
+                */
+                bool combine ( const octree& a, const octree& b, const combine_op op, const unsigned int threads = 0 ) {
+                        if ( a._root == NULL || b._root == NULL ) return false;
+                        const builtin_op f = { op, a._emptyValue, b._emptyValue };
+                        return this->combine_trees( a, b, f, f.emptyA, threads );
+                }
+
+                /**
+                * @brief replace the octree by func(a(x, y, z), b(x, y, z)) for all voxels.
+                *
+                * Same as combine() with a built-in operation, but func is applied to every
+                * pair of overlapping leaves (never to single voxels of a uniform leaf).
+                * @param[in] a the first operand (may be this octree)
+                * @param[in] b the second operand (may be this octree)
+                * @param[in] func called as T func(const T& va, const T& vb) from several threads at once.
+                * @param[in] threads the number of threads (0 : hardware concurrency)
+                * @retval true Succeeded. The empty value is func(a's empty value, b's empty value).
+                * @retval false a and b have different dimensions or are not initialized.
+                */
+                template < typename Function >
+                bool combine ( const octree& a, const octree& b, Function func, const unsigned int threads = 0 ) {
+                        if ( a._root == NULL || b._root == NULL ) return false;
+                        return this->combine_trees( a, b, func, func( a._emptyValue, b._emptyValue ), threads );
+                }
+
+                /**
+                * @brief keep a reduced value of its subtree in every intermediate node (level of detail).
+                *
+                * The values are computed now. Afterwards set() and set_batch() only mark
+                * the nodes on their paths out of date; get_at_level() reduces those on the
+                * fly (storing them unless the octree is const) and update_lod() stores all of them. Operations that rebuild large
+                * parts of the tree (build_from_dense(), read(), combine(), apply_delta())
+                * reduce the new nodes at once.
+                * @param[in] reduce reduction of 8 child values, e.g. &octree::lod_mean,
+                * &octree::lod_max or &octree::lod_or (NULL : stop keeping reduced values)
+                * @note The reduced values of subtrees shared with snapshots are copied like writes.
+                */
+                void enable_lod ( const reduce_function reduce ) {
+                        this->_reduce = reduce;
+                        if ( this->_root == NULL ) return;
+                        this->prepare_write();
+                        this->reduce_node( *(this->_root), true );
+                        return;
+                }
+
+                /**
+                * @brief stop keeping reduced values (set() no longer marks paths).
+                */
+                void disable_lod ( void ) {
+                        this->_reduce = NULL;
+                        return;
+                }
+
+                /**
+                * @retval true Intermediate nodes keep reduced values.
+                * @retval false enable_lod() is not called.
+                */
+                bool has_lod ( void ) const {
+                        return this->_reduce != NULL;
+                }
+
+                /**
+                * @brief store the reduced values of the nodes changed since the last update.
+                *
+                * Only the paths marked by set() are visited, so the cost is proportional
+                * to the changes. Call this before many get_at_level() queries over a region
+                * that was written.
+                */
+                void update_lod ( void ) {
+                        if ( this->_reduce == NULL || this->_root == NULL ) return;
+                        this->prepare_write();
+                        this->reduce_node( *(this->_root), false );
+                        return;
+                }
+
+                /**
+                * @brief get the value of (x, y, z) at a coarser level.
+                *
+                * The descent stops at the node of the given level containing (x, y, z).
+                * A leaf above that level gives its own value, an intermediate node its
+                * reduced value (see enable_lod()). The cost is O(log2(getDimension()) - level)
+                * if the node is up to date. A stale node (changed by set() since the last
+                * update_lod()) is reduced from its stale descendants, and this overload
+                * stores the result, so the next query of the node is O(log2(getDimension()) - level) again.
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[in] level level of the node (0 : voxel, log2(getDimension()) : the whole octree)
+                * @return the (reduced) value, or empty value if (x, y, z) is invalid.
+                * @note Without enable_lod() this is the same as get(). Storing reduced values is
+                * a write: it must not run concurrently with other accesses to the octree.
+                */
+                T get_at_level ( const int x, const int y, const int z, const unsigned char level ) {
+                        if ( !this->is_valid(x,y,z) ) return this->_emptyValue;
+                        if ( this->_reduce == NULL ) return this->get(x, y, z);
+                        node<T>* nd = this->_root;
+                        if ( nd->is_stale() ) this->prepare_write();
+                        for ( unsigned char l = this->_level ; l > level && !nd->is_leaf() ; ) {
+                                if ( nd->is_stale() ) nd->create_child( this->_shared->allocator ); // copies child nodes shared with snapshots.
+                                --l;
+                                nd = nd->children( this->_shared->allocator ) + node<T>::child_index(x, y, z, l);
+                        }
+                        this->reduce_node( *nd, false );
+                        return nd->value();
+                }
+
+                /**
+                * @brief get the value of (x, y, z) at a coarser level without storing reduced values.
+                *
+                * Same as the non-const overload, but a stale node is reduced from all its
+                * stale descendants on every call, so the cost grows with the number of set()
+                * calls below the node since the last update_lod(). Snapshots and const
+                * octrees use this overload; call update_lod() before taking snapshots for previews.
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[in] level level of the node (0 : voxel, log2(getDimension()) : the whole octree)
+                * @return the (reduced) value, or empty value if (x, y, z) is invalid.
+                */
+                T get_at_level ( const int x, const int y, const int z, const unsigned char level ) const {
+                        if ( !this->is_valid(x,y,z) ) return this->_emptyValue;
+                        if ( this->_reduce == NULL ) return this->get(x, y, z);
+                        const node<T>* nd = this->_root;
+                        for ( unsigned char l = this->_level ; l > level && !nd->is_leaf() ; ) {
+                                --l;
+                                nd = nd->children( this->_shared->allocator ) + node<T>::child_index(x, y, z, l);
+                        }
+                        return this->reduced_value( *nd );
+                }
+
+                /**
+                * @return a dimension of the octree. It must be a 2^n.
+                */
+                int getDimension ( void ) const {
+                        return this->_dimension;
+                }
+
+                /**
+                * @return empty value of the octree.
+                */
+                T getEmptyValue( void ) const {
+                        return this->_emptyValue;
+                }
+
+                /**
+                * @return the number of bytes used by the octree.
+                */
+                size_t bytes_used( void ) const {
+                        if ( this->_shared == NULL ) return sizeof(*this);
+                        return sizeof(*this) + sizeof(node<T>) + this->_shared->allocator.reserved_bytes();
+                }
+
+                /**
+                * @return the allocator of child nodes (e.g. to read allocation counters).
+                */
+                const typename node<T>::allocator_type& get_allocator( void ) const {
+                        static const typename node<T>::allocator_type empty;
+                        return this->_shared != NULL ? this->_shared->allocator : empty; // empty if moved out.
+                }
+
+                /**
+                * @brief count the nodes and the leaves at each depth.
+                *
+                * The split and merge counters are compiled in when MI_OCTREE_PROFILE is
+                * defined before including octree.hpp. They count since the allocator was
+                * created and are shared with snapshots.
+                * @return the profile of the octree.
+                */
+                profile get_profile ( void ) const {
+                        profile result = profile();
+                        if ( this->_root != NULL ) this->profile_node( *(this->_root), 0, result );
+                        result.bytes = this->bytes_used();
+#ifdef MI_OCTREE_PROFILE
+                        result.splits = this->_shared->allocator.splits();
+                        result.merges = this->_shared->allocator.merges();
+#endif
+                        return result;
+                }
+
+                /**
+                * @param[in] fin input file stream
+                * @retval true Succeeded.
+                * @retval false Failed.
+                */
+                bool read ( std::ifstream& fin ) {
+                        int dimension;
+                        T emptyValue;
+                        fin.read ( (char*)&dimension , sizeof(int) );
+                        if ( !fin.fail() && std::memcmp( &dimension, COMPRESSED_MAGIC, 4 ) == 0 ) return this->read_compressed(fin);
+                        fin.read ( (char*)&emptyValue, sizeof(T) );
+                        if ( !fin.fail() && ( 1 << MAX_LEVEL ) < dimension ) return false;
+                        this->init(dimension, emptyValue);
+                        if (fin.fail()) return false;
+                        const bool result = this->_root->read(fin, this->_shared->allocator);
+                        this->update_subtree( *(this->_root), this->_level, statistics_enabled() );
+                        this->reduce_node( *(this->_root), true );
+                        return result;
+                }
+                /**
+                * @param[in] fout output file stream
+                * @retval true Succeeded.
+                * @retval false Failed.
+                */
+                bool write ( std::ofstream& fout ) {
+                        if ( fout.fail() ) return false;
+                        fout.write ( (char*)&_dimension , sizeof(int) );
+                        fout.write ( (char*)&_emptyValue, sizeof(T) );
+                        if ( fout.fail() ) return false;
+                        return this->_root->write(fout, this->_shared->allocator);
+                }
+
+                /**
+                * @brief write the octree in the block format.
+                *
+                * The header (magic, byte order mark, version, value size, dimension and
+                * empty value) is followed by blocks of mi::block_writer. Each intermediate
+                * node is written as a mask of intermediate children and a mask of empty
+                * leaves, followed by its intermediate children and the values of its
+                * non-empty leaves. read() loads both this format and the original one.
+                * @param[in] out output stream (binary)
+                * @param[in] compress compress blocks or not
+                * @retval true Succeeded.
+                * @retval false Failed.
+                */
+                bool write_compressed ( std::ostream& out, const bool compress = true ) const {
+                        if ( out.fail() ) return false;
+                        uint32_t header[5];
+                        std::memcpy( &header[0], COMPRESSED_MAGIC, 4 );
+                        header[1] = flat_header::ENDIAN_MARK;
+                        header[2] = COMPRESSED_VERSION;
+                        header[3] = sizeof(T);
+                        header[4] = static_cast<uint32_t>( this->_dimension );
+                        out.write( (char*)header, sizeof(header) );
+                        out.write( (char*)&(this->_emptyValue), sizeof(T) );
+                        if ( out.fail() ) return false;
+
+                        block_writer writer( out, compress );
+                        if ( this->_root->is_leaf() ) {
+                                const T value = this->_root->value();
+                                if ( !writer.put(0) || !writer.write( &value, sizeof(T) ) ) return false;
+                        } else {
+                                if ( !writer.put(1) || !this->write_compressed_node( *(this->_root), writer ) ) return false;
+                        }
+                        return writer.finish();
+                }
+
+                /**
+                * @brief write the octree in the flat format, which octree_view maps in place.
+                * @param[in] fout output file stream (binary)
+                * @retval true Succeeded.
+                * @retval false Failed (I/O error or more than 2^32 - 1 nodes).
+                * @see flat_header
+                */
+                bool write_flat ( std::ofstream& fout ) const {
+                        static_assert( std::is_trivially_copyable<T>::value, "the flat format stores raw values" );
+                        if ( fout.fail() ) return false;
+                        std::vector< const node<T>* > nodes( 1, this->_root );
+                        for ( size_t i = 0 ; i < nodes.size() ; ++i ) {
+                                if ( nodes[i]->is_leaf() ) continue;
+                                const node<T>* child = nodes[i]->children( this->_shared->allocator );
+                                for ( int j = 0 ; j < 8 ; ++j ) nodes.push_back( child + j );
+                        }
+                        if ( nodes.size() > 0xFFFFFFFFULL ) return false;
+
+                        flat_header header;
+                        std::memset( &header, 0, sizeof(header) );
+                        std::memcpy( header.magic, "MIOCTREE", 8 );
+                        header.byte_order  = flat_header::ENDIAN_MARK;
+                        header.version     = flat_header::VERSION;
+                        header.value_size  = sizeof(T);
+                        header.record_size = sizeof(flat_record<T>);
+                        header.dimension   = this->_dimension;
+                        header.level       = this->_level;
+                        header.records     = nodes.size();
+                        fout.write( (char*)&header, sizeof(header) );
+
+                        std::vector< flat_record<T> > buffer;
+                        buffer.reserve(4096);
+                        flat_record<T> r;
+                        std::memset( &r, 0, sizeof(r) );
+                        r.value = this->_emptyValue;
+                        buffer.push_back(r);
+                        size_t next = 1;
+                        for ( size_t i = 0 ; i < nodes.size() ; ++i ) {
+                                r.child = 0;
+                                r.value = nodes[i]->value();
+                                if ( !nodes[i]->is_leaf() ) {
+                                        r.child = static_cast<uint32_t>( next - i );
+                                        next += 8;
+                                }
+                                buffer.push_back(r);
+                                if ( buffer.size() == buffer.capacity() ) {
+                                        fout.write( (char*)&buffer[0], sizeof(flat_record<T>) * buffer.size() );
+                                        buffer.clear();
+                                }
+                        }
+                        if ( !buffer.empty() ) fout.write( (char*)&buffer[0], sizeof(flat_record<T>) * buffer.size() );
+                        return !fout.fail();
+                }
+
+                /**
+                * @brief start (or stop) recording which parts of the octree are changed.
+                *
+                * set(), set_batch(), fill_box() and apply_delta() mark the cells of
+                * 2^cellLevel voxels on a side they touch, and write_delta() writes the
+                * subtrees of the marked cells. Call it right after writing a checkpoint.
+                * @param[in] enable record changes or not
+                * @param[in] cellLevel level of the cells
+                * @note init() and read() mark the whole octree, and so does a fill_box()
+                * covering more than MAX_MARKED_CELLS cells.
+                */
+                void track_changes ( const bool enable = true, const unsigned char cellLevel = 4 ) {
+                        this->_journal = enable;
+                        this->_journalAll = false;
+                        this->_journalLevel = cellLevel;
+                        this->_dirty.clear();
+                        this->_dirtyLimit = 1024;
+                        return;
+                }
+
+                /**
+                * @brief write the subtrees changed since track_changes() or the last write_delta().
+                *
+                * The header (magic, byte order mark, version, value size, dimension and
+                * empty value) is followed by blocks of mi::block_writer holding the level
+                * of the cells, the number of cells and, for each changed cell in Morton
+                * order, its Morton code and its subtree in the block format of
+                * write_compressed(). The size and the cost are proportional to the
+                * changed cells, not to the octree.
+                * @param[out] out output stream (binary)
+                * @param[in] compress compress blocks or not
+                * @retval true Succeeded. The recorded changes are cleared.
+                * @retval false Failed (changes are not tracked or I/O error).
+                * @see apply_delta()
+                */
+                bool write_delta ( std::ostream& out, const bool compress = true ) {
+                        if ( !this->_journal || this->_root == NULL || out.fail() ) return false;
+                        uint32_t header[5];
+                        std::memcpy( &header[0], DELTA_MAGIC, 4 );
+                        header[1] = flat_header::ENDIAN_MARK;
+                        header[2] = DELTA_VERSION;
+                        header[3] = sizeof(T);
+                        header[4] = static_cast<uint32_t>( this->_dimension );
+                        out.write( (char*)header, sizeof(header) );
+                        out.write( (char*)&(this->_emptyValue), sizeof(T) );
+                        if ( out.fail() ) return false;
+
+                        this->compact_journal();
+                        const std::vector<uint64_t> root( 1, 0 );
+                        const std::vector<uint64_t>& cells = this->_journalAll ? root : this->_dirty;
+                        const uint8_t level = this->_journalAll ? this->_level : this->journal_level();
+                        const uint64_t count = cells.size();
+                        block_writer writer( out, compress );
+                        if ( !writer.put( level ) || !writer.write( &count, sizeof(count) ) ) return false;
+                        for ( size_t i = 0 ; i < cells.size() ; ++i ) {
+                                const node<T>* nd = this->_root;
+                                for ( unsigned char l = this->_level ; l > level && !nd->is_leaf() ; ) {
+                                        --l;
+                                        nd = nd->children( this->_shared->allocator ) + ( ( cells[i] >> ( 3 * ( l - level ) ) ) & 7 );
+                                }
+                                if ( !writer.write( &cells[i], sizeof(uint64_t) ) ) return false;
+                                if ( nd->is_leaf() ) {
+                                        const T value = nd->value();
+                                        if ( !writer.put(0) || !writer.write( &value, sizeof(T) ) ) return false;
+                                } else {
+                                        if ( !writer.put(1) || !this->write_compressed_node( *nd, writer ) ) return false;
+                                }
+                        }
+                        if ( !writer.finish() ) return false;
+                        this->track_changes( true, this->_journalLevel );
+                        return true;
+                }
+
+                /**
+                * @brief replay a delta written by write_delta() onto the octree.
+                *
+                * Each cell in the delta replaces the subtree at the same place.
+                * @param[in] in input stream (binary)
+                * @retval true Succeeded.
+                * @retval false Failed (I/O error, corrupted data, or the delta was written
+                * by an octree with another dimension, value type or empty value).
+                * @note The octree must be in the state the delta was recorded from, e.g.
+                * the checkpoint read() and the preceding deltas applied in order.
+                */
+                bool apply_delta ( std::istream& in ) {
+                        uint32_t header[5];
+                        T emptyValue;
+                        in.read( (char*)header, sizeof(header) );
+                        in.read( (char*)&emptyValue, sizeof(T) );
+                        if ( in.fail() || std::memcmp( &header[0], DELTA_MAGIC, 4 ) != 0 ) return false;
+                        if ( header[1] != flat_header::ENDIAN_MARK || header[2] > DELTA_VERSION || header[3] != sizeof(T) ) return false;
+                        if ( this->_root == NULL || header[4] != static_cast<uint32_t>( this->_dimension ) || !( emptyValue == this->_emptyValue ) ) return false;
+                        this->prepare_write();
+                        ++this->_generation;
+
+                        block_reader reader( in );
+                        uint8_t level;
+                        uint64_t count;
+                        if ( !reader.get( level ) || !reader.read( &count, sizeof(count) ) ) return false;
+                        if ( level > this->_level || this->_level - level > MAX_MORTON_LEVEL ) return false;
+                        node<T>* path[32];
+                        for ( uint64_t k = 0 ; k < count ; ++k ) {
+                                uint64_t key;
+                                uint8_t type;
+                                if ( !reader.read( &key, sizeof(key) ) || !reader.get( type ) ) return false;
+                                if ( ( key >> ( 3 * ( this->_level - level ) ) ) != 0 ) return false;
+                                node<T>* nd = this->_root;
+                                for ( unsigned char l = this->_level ; l > level ; ) {
+                                        path[l] = nd;
+                                        nd->create_child( this->_shared->allocator );
+                                        --l;
+                                        nd = nd->children( this->_shared->allocator ) + ( ( key >> ( 3 * ( l - level ) ) ) & 7 );
+                                }
+                                nd->remove_child( this->_shared->allocator );
+                                bool result = false;
+                                if ( type == 0 ) {
+                                        T value;
+                                        result = reader.read( &value, sizeof(T) );
+                                        if ( result ) nd->set_value( value );
+                                } else if ( type == 1 ) {
+                                        result = this->read_compressed_node( *nd, level, reader );
+                                }
+                                this->update_subtree( *nd, level, statistics_enabled() );
+                                this->reduce_node( *nd, true );
+                                this->update_path( path, level + 1, this->_level + 1 );
+                                if ( !result ) return false;
+                                if ( this->_journal ) this->mark_cell( level, key );
+                        }
+                        return reader.finish();
+                }
+        private:
+                /**
+                * @brief dense voxel array given to build_from_dense().
+                */
+                struct dense_array {
+                        const T* data;
+                        int nx, ny, nz;
+                };
 
                 /**
-                * @class node
-                * @brief octree node (used in only octree<T>
+                * @class block_source
+                * @brief Hands out child blocks to a builder thread.
+                *
+                * Blocks are taken from the shared allocator in batches under the mutex,
+                * and the unused ones are returned on destruction. If the allocator
+                * cannot resolve handles while another thread allocates, statistics of
+                * the new nodes are deferred until the threads have joined.
                 */
-                template < typename U >
-                class node
+                class block_source
                 {
                 private:
-                        //definition of nodes
-                        typedef struct _nodedata {
-                                unsigned char type;
-                                unsigned char level;
-                        } nodedata;
-
-                        static unsigned char const INVALID = 0x00; ///< Invalid voxel
-                        static unsigned char const EMPTY = 0x01; ///< Empty voxel
-                        static unsigned char const INTERMEDIATE = 0x02; ///< Intermediate voxel
+                        typedef typename node<T>::allocator_type allocator_type;
+                        typedef typename node<T>::handle handle;
+                        static size_t const BATCH = 64;
 
+                        allocator_type& _alloc;
+                        std::mutex&     _mutex;
+                        std::vector< std::pair<handle, node<T>*> > _blocks;
+                        bool            _deferred;
                 private:
-                        nodedata 	_data;  ///< Meta data
-                        node<U>*	_child; ///< Pointer to child nodes
-                        U 		_value; ///< Value
+                        block_source ( const block_source& that );
+                        void operator = ( const block_source& that );
+                public:
+                        block_source ( allocator_type& alloc, std::mutex& mutex, const bool deferred = false ) : _alloc(alloc), _mutex(mutex), _deferred(deferred) {
+                                return;
+                        }
 
-                private:
                         /**
-                        * @brief Default Contructor
-                        * @note Used in only node class.
+                        * @param[in] threads the number of builder threads
+                        * @retval true Statistics must be deferred.
                         */
-                        node( void ) {
-                                this->_child = NULL;
-                                this->_data.type = INVALID;
-                                this->_data.level = 0x00;
-                                this->_value = U();
-                                return;
+                        static bool defer_statistics ( const unsigned int threads ) {
+                                return threads > 1 && Statistics::enabled && !allocator_type::concurrent_resolve;
                         }
-                public:
+
                         /**
-                        * @brief Constructor
-                        * @param[in] lv Current level.
-                        * @param[in] value Set value.
+                        * @retval true Statistics are updated by update_results() later.
+                        * @retval false Statistics are updated when children are merged.
                         */
-                        node( const unsigned char lv, const U value ) {
+                        bool deferred ( void ) const {
+                                return this->_deferred;
+                        }
 
-                                this->_child	= NULL;
-                                this->init(lv, value);
-                                this->_data.type = EMPTY;
+                        ~block_source ( void ) {
+                                std::lock_guard<std::mutex> lock( this->_mutex );
+                                for ( size_t i = 0 ; i < this->_blocks.size() ; ++i ) this->_alloc.deallocate( this->_blocks[i].first );
                                 return;
                         }
+
                         /**
-                        * @brief Destructor
+                        * @return a handle to a block and a pointer to its 8 nodes.
                         */
-                        virtual ~node( void ) {
-                                this->remove_child();
+                        std::pair<handle, node<T>*> acquire ( void ) {
+                                if ( this->_blocks.empty() ) {
+                                        std::lock_guard<std::mutex> lock( this->_mutex );
+                                        for ( size_t i = 0 ; i < BATCH ; ++i ) {
+                                                const handle h = this->_alloc.allocate();
+                                                this->_blocks.push_back( std::make_pair( h, this->_alloc.resolve(h)->child ) );
+                                        }
+                                }
+                                const std::pair<handle, node<T>*> b = this->_blocks.back();
+                                this->_blocks.pop_back();
+                                return b;
+                        }
+                };
+
+                /**
+                * @brief build a subtree from a dense array.
+                * @param[out] nd the root of the subtree (a leaf)
+                * @param[in] level level of nd
+                * @param[in] ox x-coordinate of the origin of nd
+                * @param[in] oy y-coordinate of the origin of nd
+                * @param[in] oz z-coordinate of the origin of nd
+                * @param[in] src dense array
+                * @param[in] blocks source of child blocks
+                */
+                void build_dense_node ( node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz,
+                                        const dense_array& src, block_source& blocks ) const {
+                        if ( src.nx <= ox || src.ny <= oy || src.nz <= oz ) {
+                                nd.set_value(this->_emptyValue);
+                                return;
+                        }
+                        if ( level == 0 ) {
+                                nd.set_value( src.data[ ox + static_cast<size_t>(src.nx) * ( oy + static_cast<size_t>(src.ny) * oz ) ] );
                                 return;
                         }
+                        node<T> child[8];
+                        const int d = 1 << ( level - 1 );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->build_dense_node( child[i], level - 1, ox + ( i & 1 ) * d, oy + ( ( i >> 1 ) & 1 ) * d, oz + ( ( i >> 2 ) & 1 ) * d, src, blocks );
+                        }
+                        this->merge_children( nd, level, child, blocks );
+                        return;
+                }
 
-                        /**
-                        * @brief get value at (x, y, z)
-                        * @param[in] x x-coordinate
-                        * @param[in] y y-coordinate
-                        * @param[in] z z-coordinate
-                        * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
-                        */
+                /**
+                * @brief build the top levels from the subtrees built by threads.
+                * @param[out] nd the root of the subtree (a leaf)
+                * @param[in] level level of nd
+                * @param[in] depth the number of levels down to the subtrees
+                * @param[in] index index of nd among nodes of the same depth
+                * @param[in] results subtrees built by threads
+                * @param[in] blocks source of child blocks
+                */
+                void assemble_dense_node ( node<T>& nd, const unsigned char level, const unsigned char depth, const size_t index,
+                                           const std::vector< node<T> >& results, block_source& blocks ) const {
+                        if ( depth == 0 ) {
+                                nd = results[index];
+                                return;
+                        }
+                        node<T> child[8];
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->assemble_dense_node( child[i], level - 1, depth - 1, index * 8 + i, results, blocks );
+                        }
+                        this->merge_children( nd, level, child, blocks );
+                        return;
+                }
+
+                /**
+                * @brief make nd a leaf if the children are uniform leaves, otherwise move them into a new block.
+                */
+                void merge_children ( node<T>& nd, const unsigned char level, const node<T>* child, block_source& blocks ) const {
+                        bool uniform = true;
+                        for ( int i = 0 ; i < 8 && uniform ; ++i ) {
+                                uniform = child[i].is_leaf() && child[i].value() == child[0].value();
+                        }
+                        if ( uniform ) {
+                                nd.set_value( child[0].value() );
+                                return;
+                        }
+                        const std::pair<typename node<T>::handle, node<T>*> b = blocks.acquire();
+                        for ( int i = 0 ; i < 8 ; ++i ) b.second[i] = child[i];
+                        nd.attach_children( b.first );
+                        if ( !blocks.deferred() ) this->update_node( nd, level );
+                        return;
+                }
+
+                /**
+                * @brief add the nodes of a subtree to a profile.
+                */
+                void profile_node ( const node<T>& nd, const unsigned char depth, profile& result ) const {
+                        ++result.nodes;
+                        if ( nd.is_leaf() ) {
+                                ++result.leaves;
+                                ++result.depth[depth];
+                                return;
+                        }
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) this->profile_node( child[i], depth + 1, result );
+                        return;
+                }
 
+                /**
+                * @brief reduce the values of intermediate nodes of a subtree bottom-up.
+                * @param[in] nd the root of the subtree
+                * @param[in] all if true, every intermediate node, otherwise only stale ones
+                */
+                void reduce_node ( node<T>& nd, const bool all ) {
+                        if ( this->_reduce == NULL || nd.is_leaf() || !( all || nd.is_stale() ) ) return;
+                        nd.create_child( this->_shared->allocator ); // copies child nodes shared with snapshots.
+                        node<T>* child = nd.children( this->_shared->allocator );
+                        T values[8];
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->reduce_node( child[i], all );
+                                values[i] = child[i].value();
+                        }
+                        nd.set_reduced( this->_reduce( values ) );
+                        return;
+                }
 
+                /**
+                * @return the reduced value of nd, reducing stale descendants without storing them.
+                */
+                T reduced_value ( const node<T>& nd ) const {
+                        if ( nd.is_leaf() || !nd.is_stale() ) return nd.value();
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        T values[8];
+                        for ( int i = 0 ; i < 8 ; ++i ) values[i] = this->reduced_value( child[i] );
+                        return this->_reduce( values );
+                }
 
-                        T get (const int x, const int y, const int z) const {
-                                if (this->_data.type == INTERMEDIATE ) {
-                                        const int d 	= static_cast<int>(pow(2.0, this->_data.level-1));
-                                        return this->_child[(x/d) + 2 * (y/d) + 4 * (z/d)].get(x % d, y % d, z % d);
+                /**
+                * @brief recompute statistics of subtrees built with deferred statistics.
+                * @param[in] results subtrees built by threads
+                * @param[in] level level of the subtrees
+                * @param[in] threads the number of threads
+                */
+                void update_results ( const std::vector< node<T> >& results, const unsigned char level, const unsigned int threads ) const {
+                        std::atomic<size_t> next(0);
+                        auto worker = [&] ( void ) {
+                                for ( size_t t = next++ ; t < results.size() ; t = next++ ) {
+                                        this->update_subtree( results[t], level, statistics_enabled() );
+                                }
+                        };
+                        std::vector<std::thread> pool;
+                        for ( unsigned int i = 1 ; i < threads && i < results.size() ; ++i ) pool.push_back( std::thread(worker) );
+                        worker();
+                        for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+                        return;
+                }
+
+                /**
+                * @brief the function object of the built-in operations of combine().
+                */
+                struct builtin_op {
+                        combine_op op;
+                        T emptyA; ///< Empty value of a (and the result).
+                        T emptyB; ///< Empty value of b.
+                        T operator () ( const T& va, const T& vb ) const {
+                                const bool a = !( va == this->emptyA );
+                                const bool b = !( vb == this->emptyB );
+                                switch ( this->op ) {
+                                case UNION:        return a ? va : ( b ? vb : this->emptyA );
+                                case INTERSECTION: return ( a && b ) ? va : this->emptyA;
+                                case DIFFERENCE:   return ( a && !b ) ? va : this->emptyA;
+                                case MINIMUM:      return ( vb < va ) ? vb : va;
+                                default:           return ( va < vb ) ? vb : va;
                                 }
-                                return this->_value;
                         }
-                        /**
-                        * @brief set value at (x, y, z)
-                        * @param[in] x x-coordinate
-                        * @param[in] y y-coordinate
-                        * @param[in] z z-coordinate
-                        * @param[in] v value
-                        * @note do nothing if (x,y,z) is invalid.
-                        */
+                };
 
-                        void set (const int x, const int y, const int z, const U v) {
-                                if ( this->_data.level == 0 ) {
-                                        this->_value = v ;
-                                } else {
-                                        this->create_child();
-                                        const size_t d 	= static_cast<size_t>(pow(2.0, this->_data.level-1));
-                                        this->_child[(x/d) + 2 * (y/d) + 4 * (z/d)].set(x % d, y % d, z % d, v);
+                static int const COMBINE_NONE = 0;     ///< The result depends on the other operand.
+                static int const COMBINE_CONSTANT = 1; ///< The result is a single value.
+                static int const COMBINE_IDENTITY = 2; ///< The result equals the other operand.
+
+                /**
+                * @brief what a uniform operand decides for a user function (nothing).
+                */
+                template < typename Function >
+                static int combine_shortcut ( const Function&, const T&, const bool, T& ) {
+                        return COMBINE_NONE;
+                }
+
+                /**
+                * @param[in] f operation
+                * @param[in] v value of a uniform leaf
+                * @param[in] left v is of a (true) or b (false)
+                * @param[out] value the result if COMBINE_CONSTANT is returned
+                * @return COMBINE_NONE, COMBINE_CONSTANT or COMBINE_IDENTITY
+                */
+                static int combine_shortcut ( const builtin_op& f, const T& v, const bool left, T& value ) {
+                        const bool empty = left ? ( v == f.emptyA ) : ( v == f.emptyB );
+                        value = f.emptyA;
+                        switch ( f.op ) {
+                        case UNION:
+                                if ( !left ) return empty ? COMBINE_IDENTITY : COMBINE_NONE;
+                                if ( empty ) return ( f.emptyA == f.emptyB ) ? COMBINE_IDENTITY : COMBINE_NONE;
+                                value = v;
+                                return COMBINE_CONSTANT;
+                        case INTERSECTION:
+                                if ( empty ) return COMBINE_CONSTANT;
+                                return left ? COMBINE_NONE : COMBINE_IDENTITY;
+                        case DIFFERENCE:
+                                if ( left ) return empty ? COMBINE_CONSTANT : COMBINE_NONE;
+                                return empty ? COMBINE_IDENTITY : COMBINE_CONSTANT;
+                        default:
+                                return COMBINE_NONE;
+                        }
+                }
+
+                /**
+                * @brief operands of combine().
+                */
+                template < typename Function >
+                struct combine_source {
+                        const octree& a;
+                        const octree& b;
+                        const Function& func;
+                };
+
+                /**
+                * @brief combine two octrees into this octree (see combine()).
+                * @param[in] emptyValue empty value of the result
+                */
+                template < typename Function >
+                bool combine_trees ( const octree& a, const octree& b, const Function& func, const T emptyValue, unsigned int threads ) {
+                        if ( a._root == NULL || b._root == NULL || a._dimension != b._dimension ) return false;
+                        if ( threads == 0 ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+                        if ( a._shared == this->_shared || b._shared == this->_shared ) threads = 1;
+                        this->prepare_write();
+                        ++this->_generation;
+                        if ( this->_journal ) this->_journalAll = true;
+                        const unsigned char level = a._level;
+                        const int dimension = a._dimension;
+                        this->_emptyValue = emptyValue; // used by statistics of new nodes.
+
+                        const combine_source<Function> src = { a, b, func };
+                        const unsigned char split = ( threads > 1 ) ? std::min<unsigned char>( level, 2 ) : 0;
+                        const size_t tasks = size_t(1) << ( 3 * split );
+                        std::vector< node<T> > results( tasks );
+                        std::atomic<size_t> next(0);
+                        std::mutex mutex;
+                        const bool deferred = block_source::defer_statistics( threads );
+
+                        auto worker = [&] ( void ) {
+                                block_source blocks( this->_shared->allocator, mutex, deferred );
+                                for ( size_t t = next++ ; t < tasks ; t = next++ ) {
+                                        const node<T>* na = a._root;
+                                        const node<T>* nb = b._root;
+                                        for ( unsigned char k = 0 ; k < split ; ++k ) {
+                                                const size_t id = ( t >> ( 3 * ( split - 1 - k ) ) ) & 7;
+                                                if ( !na->is_leaf() ) na = na->children( a._shared->allocator ) + id;
+                                                if ( !nb->is_leaf() ) nb = nb->children( b._shared->allocator ) + id;
+                                        }
+                                        this->combine_node( results[t], level - split, *na, *nb, src, blocks );
+                                }
+                        };
+                        std::vector<std::thread> pool;
+                        for ( unsigned int i = 1 ; i < threads && i < tasks ; ++i ) pool.push_back( std::thread(worker) );
+                        worker();
+                        for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+
+                        node<T>* root = new node<T>( emptyValue );
+                        {
+                                block_source blocks( this->_shared->allocator, mutex );
+                                if ( deferred ) this->update_results( results, level - split, threads );
+                                this->assemble_dense_node( *root, level, split, 0, results, blocks );
+                        }
+                        if ( this->_root != NULL ) {
+                                this->_root->remove_child( this->_shared->allocator ); // after the operands were read.
+                                delete this->_root;
+                        }
+                        this->_root = root;
+                        this->_level = level;
+                        this->_dimension = dimension;
+                        this->reduce_node( *(this->_root), true );
+                        return true;
+                }
+
+                /**
+                * @brief combine subtrees of the operands.
+                * @param[out] out the root of the result (a leaf)
+                * @param[in] level level of the subtrees
+                * @param[in] na the subtree of a
+                * @param[in] nb the subtree of b
+                * @param[in] src operands and operation
+                * @param[in] blocks source of child blocks
+                */
+                template < typename Function >
+                void combine_node ( node<T>& out, const unsigned char level, const node<T>& na, const node<T>& nb,
+                                    const combine_source<Function>& src, block_source& blocks ) const {
+                        if ( na.is_leaf() && nb.is_leaf() ) {
+                                out.set_value( src.func( na.value(), nb.value() ) );
+                                return;
+                        }
+                        T value;
+                        if ( na.is_leaf() || nb.is_leaf() ) {
+                                const bool left = na.is_leaf();
+                                const octree& other = left ? src.b : src.a;
+                                const int shortcut = combine_shortcut( src.func, left ? na.value() : nb.value(), left, value );
+                                if ( shortcut == COMBINE_CONSTANT ) {
+                                        out.set_value( value );
+                                        return;
+                                }
+                                if ( shortcut == COMBINE_IDENTITY && other._shared == this->_shared ) {
+                                        out = left ? nb : na;
+                                        out.get_block( this->_shared->allocator )->_refs.fetch_add( 1, std::memory_order_relaxed );
+                                        return;
                                 }
+                        }
+                        const node<T>* ca = na.is_leaf() ? NULL : na.children( src.a._shared->allocator );
+                        const node<T>* cb = nb.is_leaf() ? NULL : nb.children( src.b._shared->allocator );
+                        node<T> child[8];
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->combine_node( child[i], level - 1, ( ca != NULL ) ? ca[i] : na, ( cb != NULL ) ? cb[i] : nb, src, blocks );
+                        }
+                        this->merge_children( out, level, child, blocks );
+                        return;
+                }
+
+                /**
+                * @brief collect intermediate nodes at the given depth.
+                * @param[in] nd the root of the subtree
+                * @param[in] depth depth of the nodes to collect
+                * @param[out] nodes collected nodes
+                */
+                void collect_subtrees ( node<T>& nd, const unsigned char depth, std::vector< node<T>* >& nodes ) {
+                        if ( nd.is_leaf() || nd.is_shared( this->_shared->allocator ) ) return;
+                        if ( depth == 0 ) {
+                                nodes.push_back( &nd );
                                 return;
                         }
+                        node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) this->collect_subtrees( child[i], depth - 1, nodes );
+                        return;
+                }
 
+                /**
+                * @brief merge uniform nodes above the subtrees optimized by threads.
+                * @param[in] nd the root of the subtree
+                * @param[in] depth the number of levels down to the optimized subtrees
+                * @param[out] freed handles of detached blocks
+                * @return the number of freed nodes.
+                */
+                size_t optimize_top ( node<T>& nd, const unsigned char depth, std::vector<typename node<T>::handle>& freed ) {
+                        if ( depth == 0 || nd.is_leaf() || nd.is_shared( this->_shared->allocator ) ) return 0;
+                        size_t count = 0;
+                        node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) count += this->optimize_top( child[i], depth - 1, freed );
+                        return count + nd.merge_uniform( this->_shared->allocator, freed );
+                }
 
-                        /**
-                        * @param[in] fin input file stream
-                        * @retval true Succeeded.
-                        * @retval false Failed.
-                        */
-                        bool boundingbox(const U emptyValue,
-                                         int& mnx, int& mny, int& mnz,
-                                         int& mxx, int& mxy, int& mxz) {
-                                const int d = static_cast< int >( pow(2.0, this->_data.level ) );
-                                mnx = mny = mnz = d - 1;
-                                mxx = mxy = mxz = 0;
+                /**
+                * @brief set value at (x, y, z) without cached statistics.
+                */
+                template < typename V >
+                void set_node ( const int x, const int y, const int z, V&& v, std::false_type ) {
+                        if ( this->_reduce != NULL ) {
+                                this->set_node( x, y, z, std::forward<V>(v), std::true_type() ); // keeps the path.
+                                return;
+                        }
+                        this->_root->set( this->_level, x, y, z, std::forward<V>(v), this->_shared->allocator );
+                        return;
+                }
 
-                                if ( this->_data.type == EMPTY ) {
-                                        if ( this->_value != emptyValue) {
-                                                mnx = mny = mnz = 0;
-                                                mxx = mxy = mxz = d - 1;
-                                                return true;
-                                        } else {
-                                                return false;
-                                        }
-                                } else if ( this->_data.type == INTERMEDIATE ) {
-                                        for (int z = 0 ; z < 2 ; z++) {
-                                                for (int y = 0 ; y < 2 ; y++) {
-                                                        for (int x = 0 ; x < 2 ; x++) {
-                                                                const int id = x + 2 * y + 4 * z;
+                /**
+                * @brief set value at (x, y, z) and update cached statistics along the path.
+                */
+                template < typename V >
+                void set_node ( const int x, const int y, const int z, V&& v, std::true_type ) {
+                        node<T>* path[32];
+                        node<T>* nd = this->_root;
+                        for ( unsigned char l = this->_level ; l > 0 ; ) {
+                                path[l] = nd;
+                                nd->create_child( this->_shared->allocator );
+                                --l;
+                                nd = nd->children( this->_shared->allocator ) + node<T>::child_index(x, y, z, l);
+                        }
+                        nd->set_value( std::forward<V>(v) );
+                        this->update_path( path, 1, this->_level + 1 );
+                        return;
+                }
 
-                                                                int lnx, lny, lnz, lxx, lxy, lxz;
-                                                                if ( !this->_child[id].boundingbox(emptyValue, lnx, lny, lnz, lxx, lxy, lxz) ) continue;
-                                                                const int offx = d/2 * x;
-                                                                const int offy = d/2 * y;
-                                                                const int offz = d/2 * z;
+                /**
+                * @brief update cached statistics of path[from], ..., path[to - 1] in this order.
+                */
+                void update_path ( node<T>* const* path, const unsigned char from, const unsigned char to ) const {
+                        if ( this->_reduce != NULL ) {
+                                for ( unsigned char l = from ; l < to ; ++l ) path[l]->mark_stale();
+                        }
+                        if ( !Statistics::enabled ) return;
+                        for ( unsigned char l = from ; l < to ; ++l ) this->update_node( *(path[l]), l );
+                        return;
+                }
 
-                                                                lnx += offx;
-                                                                lny += offy;
-                                                                lnz += offz;
+                /**
+                * @brief update cached statistics of nd from its child nodes.
+                */
+                void update_node ( const node<T>& nd, const unsigned char level ) const {
+                        this->update_node( nd, level, statistics_enabled() );
+                        return;
+                }
 
-                                                                lxx += offx;
-                                                                lxy += offy;
-                                                                lxz += offz;
+                void update_node ( const node<T>&, const unsigned char, std::false_type ) const {
+                        return;
+                }
 
-                                                                if ( lnx < mnx ) mnx = lnx;
-                                                                if ( lny < mny ) mny = lny;
-                                                                if ( lnz < mnz ) mnz = lnz;
-                                                                if ( lxx > mxx ) mxx = lxx;
-                                                                if ( lxy > mxy ) mxy = lxy;
-                                                                if ( lxz > mxz ) mxz = lxz;
-                                                        }
-                                                }
-                                        }
-                                        return mnx <= mxx && mny <= mxy && mnz <= mxz;
-                                } else {
-                                        return false;
+                void update_node ( const node<T>& nd, const unsigned char level, std::true_type ) const {
+                        if ( nd.is_leaf() ) return;
+                        block* b = nd.get_block( this->_shared->allocator );
+                        uint64_t nonempty = 0;
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                uint64_t n;
+                                T mn, mx;
+                                this->get_statistics( b->child[i], level - 1, n, mn, mx, std::true_type() );
+                                nonempty += n;
+                                if ( i == 0 || mn < b->min ) b->min = mn;
+                                if ( i == 0 || b->max < mx ) b->max = mx;
+                        }
+                        b->nonempty = nonempty;
+                        return;
+                }
+
+                /**
+                * @brief recompute cached statistics of a whole subtree.
+                */
+                void update_subtree ( const node<T>&, const unsigned char, std::false_type ) const {
+                        return;
+                }
+
+                void update_subtree ( const node<T>& nd, const unsigned char level, std::true_type ) const {
+                        if ( nd.is_leaf() ) return;
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) this->update_subtree( child[i], level - 1, std::true_type() );
+                        this->update_node( nd, level, std::true_type() );
+                        return;
+                }
+
+                /**
+                * @brief get the number of non-empty voxels and the range of values in a subtree.
+                * @param[in] nd the root of the subtree
+                * @param[in] level level of nd
+                * @param[out] nonempty the number of non-empty voxels
+                * @param[out] mn minimum value
+                * @param[out] mx maximum value
+                */
+                void get_statistics ( const node<T>& nd, const unsigned char level, uint64_t& nonempty, T& mn, T& mx, std::true_type ) const {
+                        if ( nd.is_leaf() ) {
+                                nonempty = ( nd.value() == this->_emptyValue ) ? 0 : ( uint64_t(1) << ( 3 * level ) );
+                                mn = mx = nd.value();
+                                return;
+                        }
+                        const block* b = nd.get_block( this->_shared->allocator );
+                        nonempty = b->nonempty;
+                        mn = b->min;
+                        mx = b->max;
+                        return;
+                }
+
+                void get_statistics ( const node<T>& nd, const unsigned char level, uint64_t& nonempty, T& mn, T& mx, std::false_type ) const {
+                        if ( nd.is_leaf() ) {
+                                nonempty = ( nd.value() == this->_emptyValue ) ? 0 : ( uint64_t(1) << ( 3 * level ) );
+                                mn = mx = nd.value();
+                                return;
+                        }
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        nonempty = 0;
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                uint64_t n;
+                                T cmn, cmx;
+                                this->get_statistics( child[i], level - 1, n, cmn, cmx, std::false_type() );
+                                nonempty += n;
+                                if ( i == 0 || cmn < mn ) mn = cmn;
+                                if ( i == 0 || mx < cmx ) mx = cmx;
+                        }
+                        return;
+                }
+
+                size_t count_nonempty ( std::false_type ) const {
+                        return ( size_t(1) << ( 3 * this->_level ) ) - this->count_node( *(this->_root), this->_level, this->_emptyValue );
+                }
+
+                size_t count_nonempty ( std::true_type ) const {
+                        uint64_t nonempty;
+                        T mn, mx;
+                        this->get_statistics( *(this->_root), this->_level, nonempty, mn, mx, std::true_type() );
+                        return nonempty;
+                }
+
+                /**
+                * @retval true The subtree is known to be empty from cached statistics.
+                * @retval false The subtree is not empty or nothing is cached.
+                */
+                bool is_empty_subtree ( const node<T>& nd, const unsigned char level ) const {
+                        return this->is_empty_subtree( nd, level, statistics_enabled() );
+                }
+
+                bool is_empty_subtree ( const node<T>&, const unsigned char, std::false_type ) const {
+                        return false;
+                }
+
+                bool is_empty_subtree ( const node<T>& nd, const unsigned char, std::true_type ) const {
+                        return !nd.is_leaf() && nd.get_block( this->_shared->allocator )->nonempty == 0;
+                }
+
+                /**
+                * @return the number of voxels with the value in a subtree.
+                */
+                size_t count_node ( const node<T>& nd, const unsigned char level, const T& value ) const {
+                        if ( nd.is_leaf() ) return ( nd.value() == value ) ? ( size_t(1) << ( 3 * level ) ) : 0;
+                        const int range = this->compare_range( nd, value, statistics_enabled() );
+                        if ( range < 0 ) return 0;
+                        if ( range > 0 ) return size_t(1) << ( 3 * level );
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        size_t count = 0;
+                        for ( int i = 0 ; i < 8 ; ++i ) count += this->count_node( child[i], level - 1, value );
+                        return count;
+                }
+
+                /**
+                * @retval -1 The value is out of the cached range of an intermediate node.
+                * @retval 1 All voxels of the node have the value.
+                * @retval 0 Unknown.
+                */
+                int compare_range ( const node<T>&, const T&, std::false_type ) const {
+                        return 0;
+                }
+
+                int compare_range ( const node<T>& nd, const T& value, std::true_type ) const {
+                        const block* b = nd.get_block( this->_shared->allocator );
+                        if ( value < b->min || b->max < value ) return -1;
+                        if ( !( b->min < b->max ) ) return 1;
+                        return 0;
+                }
+
+                static char const* const COMPRESSED_MAGIC; ///< Magic of the block format ("MIOZ").
+                static uint32_t const COMPRESSED_VERSION = 1; ///< Version of the block format.
+                static char const* const DELTA_MAGIC; ///< Magic of the delta format ("MIOD").
+                static uint32_t const DELTA_VERSION = 1; ///< Version of the delta format.
+                static size_t const MAX_MARKED_CELLS = 4096; ///< A larger change marks the whole octree.
+
+                /**
+                * @brief write an intermediate node in the block format.
+                */
+                bool write_compressed_node ( const node<T>& nd, block_writer& writer ) const {
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        uint8_t intermediate = 0, empty = 0;
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                if ( !child[i].is_leaf() ) intermediate |= 1 << i;
+                                else if ( child[i].value() == this->_emptyValue ) empty |= 1 << i;
+                        }
+                        if ( !writer.put( intermediate ) || !writer.put( empty ) ) return false;
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                if ( intermediate & ( 1 << i ) ) {
+                                        if ( !this->write_compressed_node( child[i], writer ) ) return false;
+                                } else if ( !( empty & ( 1 << i ) ) ) {
+                                        if ( !writer.write( &( child[i].value() ), sizeof(T) ) ) return false;
                                 }
                         }
+                        return true;
+                }
 
-                        bool optimize( void ) {
-                                if ( this->_data.type == INTERMEDIATE ) {
-                                        for ( int i = 0 ; i < 8 ; i++ ) {
-                                                if ( !this->_child[i].optimize() ) return false;
-                                        }
-                                        this->_value = this->_child[0]._value;
-                                        this->remove_child();
-                                }
-                                return true;
+                /**
+                * @brief read the block format after its magic.
+                */
+                bool read_compressed ( std::istream& in ) {
+                        uint32_t header[4];
+                        T emptyValue;
+                        in.read( (char*)header, sizeof(header) );
+                        in.read( (char*)&emptyValue, sizeof(T) );
+                        if ( in.fail() ) return false;
+                        if ( header[0] != flat_header::ENDIAN_MARK || header[1] > COMPRESSED_VERSION || header[2] != sizeof(T) ) return false;
+                        if ( ( uint32_t(1) << MAX_LEVEL ) < header[3] ) return false;
+                        this->init( static_cast<int>( header[3] ), emptyValue );
+
+                        block_reader reader( in );
+                        uint8_t type;
+                        bool result = reader.get( type );
+                        if ( result && type == 0 ) {
+                                T value;
+                                result = reader.read( &value, sizeof(T) );
+                                this->_root->set_value( value );
+                        } else if ( result && type == 1 ) {
+                                result = this->read_compressed_node( *(this->_root), this->_level, reader );
+                        } else {
+                                result = false;
                         }
-                        bool read ( std::ifstream& fin ) {
-                                unsigned char type;
-                                fin.read( (char*)&type, sizeof(unsigned char) );
-                                if ( fin.fail() ) return false;
-                                switch ( type ) {
-                                case INTERMEDIATE:
-                                        this->create_child();
-                                        for ( int i = 0 ; i < 8 ; i++) {
-                                                if ( !this->_child[i].read(fin) ) return false;
-                                        }
-                                        return true;
+                        result = result && reader.finish();
+                        this->update_subtree( *(this->_root), this->_level, statistics_enabled() );
+                        this->reduce_node( *(this->_root), true );
+                        return result;
+                }
 
-                                case EMPTY:
-                                        fin.read( (char*)&_value, sizeof(U) );
-                                        return !fin.bad();
+                /**
+                * @brief read an intermediate node in the block format.
+                */
+                bool read_compressed_node ( node<T>& nd, const unsigned char level, block_reader& reader ) {
+                        uint8_t intermediate, empty;
+                        if ( level == 0 || !reader.get( intermediate ) || !reader.get( empty ) ) return false;
+                        if ( ( intermediate & empty ) != 0 ) return false;
+                        nd.create_child( this->_shared->allocator );
+                        node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                if ( intermediate & ( 1 << i ) ) {
+                                        if ( !this->read_compressed_node( child[i], level - 1, reader ) ) return false;
+                                } else if ( empty & ( 1 << i ) ) {
+                                        child[i].set_value( this->_emptyValue );
+                                } else {
+                                        T value;
+                                        if ( !reader.read( &value, sizeof(T) ) ) return false;
+                                        child[i].set_value( value );
                                 }
-                                _data.type = INVALID;
-                                return false;
                         }
+                        return true;
+                }
 
-                        /**
-                        * @param[in] fout output file stream
-                        * @retval true Succeeded.
-                        * @retval false Failed.
-                        */
-                        bool write ( std::ofstream& fout ) {
+                /**
+                * @return level of the cells recorded by track_changes().
+                */
+                unsigned char journal_level ( void ) const {
+                        return std::min( this->_journalLevel, this->_level );
+                }
 
-                                fout.write((char*)&(_data.type), 1);
-                                switch (_data.type) {
-                                case INTERMEDIATE:
-                                        for ( int i = 0 ; i < 8 ; i++) {
-                                                if ( !this->_child[i].write(fout)) return false;
-                                        }
-                                        return true;
+                /**
+                * @brief record a change of the cell containing (x, y, z).
+                */
+                void mark_dirty ( const int x, const int y, const int z ) {
+                        const unsigned char c = this->journal_level();
+                        if ( this->_level - c > MAX_MORTON_LEVEL ) this->_journalAll = true;
+                        else this->mark_key( morton_code::encode( x >> c, y >> c, z >> c ) );
+                        return;
+                }
 
-                                case EMPTY:
-                                        fout.write( (char*) &(_value), sizeof(U) );
-                                        return true;
-                                }
-                                return false;
+                /**
+                * @brief record a change of the cells intersecting the box (not clipped yet).
+                */
+                void mark_box ( const int* box ) {
+                        const unsigned char c = this->journal_level();
+                        int b[6];
+                        for ( int i = 0 ; i < 3 ; ++i ) {
+                                b[i]     = std::max( box[i], 0 ) >> c;
+                                b[i + 3] = std::min( box[i + 3], this->_dimension - 1 ) >> c;
+                                if ( box[i + 3] < 0 || this->_dimension <= box[i] || box[i + 3] < box[i] ) return;
                         }
-                        /**
-                        * @brief Copy object.
-                        * @param[in] d Copying instances.
-                        */
-                        void copy ( const node<T>& d ) {
-                                this->_data.level = d._data.level;
-                                this->_value = d._value;
-                                if ( d._data.type == INTERMEDIATE ) {
-                                        this->create_child();
-                                        for (int i = 0 ; i < 8 ; i++) {
-                                                this->_child[i].copy(d._child[i]);
-                                        }
-                                }
-                                this->_data.type = d._data.type;
+                        const uint64_t n = uint64_t( b[3] - b[0] + 1 ) * uint64_t( b[4] - b[1] + 1 ) * uint64_t( b[5] - b[2] + 1 );
+                        if ( n > MAX_MARKED_CELLS || this->_level - c > MAX_MORTON_LEVEL ) {
+                                this->_journalAll = true;
                                 return;
                         }
-                        /**
-                        * @brief Initializing child nodes.
-                        * @param[in] lv Level of the node.
-                        * @param[in] value Value.
-                        */
-                        void init ( const unsigned char lv, const U value ) {
-                                this->_data.level 	= lv;
-                                this->_value 		= value;
-                                this->_data.type 	= EMPTY;
-                                return;
-                        };
-
-                        /**
-                        * @brief allocating child nodes.
-                        */
-                        void create_child( void ) {
-                                if (this->_data.type == EMPTY ) {
-                                        this->_data.type = INTERMEDIATE;
-                                        this->_child = new node<U>[8];
-                                        for ( int i = 0 ; i < 8 ; ++i) {
-                                                this->_child[i].init(this->_data.level - 0x01, this->_value);
-                                        }
+                        for ( int z = b[2] ; z <= b[5] ; ++z ) {
+                                for ( int y = b[1] ; y <= b[4] ; ++y ) {
+                                        for ( int x = b[0] ; x <= b[3] ; ++x ) this->mark_key( morton_code::encode(x, y, z) );
                                 }
+                        }
+                        return;
+                }
+
+                /**
+                * @brief record a change of a cell of any level given by its Morton code.
+                */
+                void mark_cell ( const unsigned char level, const uint64_t key ) {
+                        const unsigned char c = this->journal_level();
+                        if ( level <= c ) {
+                                this->mark_key( key >> ( 3 * ( c - level ) ) );
                                 return;
                         }
-                        /**
-                        * @brief deallocating child nodes.
-                        */
-                        void remove_child( void ) {
-                                if ( this->_data.type == INTERMEDIATE ) {
-                                        this->_data.type = EMPTY;
-                                        delete[] this->_child;
-                                }
+                        const uint64_t n = uint64_t(1) << ( 3 * ( level - c ) );
+                        if ( n > MAX_MARKED_CELLS ) {
+                                this->_journalAll = true;
                                 return;
                         }
-                };
+                        for ( uint64_t i = 0 ; i < n ; ++i ) this->mark_key( ( key << ( 3 * ( level - c ) ) ) | i );
+                        return;
+                }
+
+                void mark_key ( const uint64_t key ) {
+                        if ( this->_journalAll ) return;
+                        if ( !this->_dirty.empty() && this->_dirty.back() == key ) return;
+                        this->_dirty.push_back( key );
+                        if ( this->_dirty.size() >= this->_dirtyLimit ) {
+                                this->compact_journal();
+                                this->_dirtyLimit = std::max( this->_dirtyLimit, 2 * this->_dirty.size() );
+                        }
+                        return;
+                }
 
-        private:
-                unsigned char   _level; ///< Maximum level of the octree.
-                int		_dimension; ///< Size of the octree.
-                T		_emptyValue; ///< Empty value of the octree.
-                node<T>*	_root; ///< A pointer to root pointer.
-	private:
-		octree ( const octree<T>& that);
-		void operator = ( const octree<T>& that);
-        public:
                 /**
-                * @brief Default constructor.
-                *
+                * @brief sort the recorded cells and remove duplicates.
                 */
-                octree ( void ) {
-                        this->_root = NULL;
+                void compact_journal ( void ) {
+                        std::sort( this->_dirty.begin(), this->_dirty.end() );
+                        this->_dirty.erase( std::unique( this->_dirty.begin(), this->_dirty.end() ), this->_dirty.end() );
+                        return;
                 }
+
                 /**
-                * @param[in] dimension dimension of the octree
-                * @param[in] emptyValue the default value of the octree
+                * @retval 0 The node (ox, oy, oz) - (ox + d - 1, ...) and the box are disjoint.
+                * @retval 1 The node intersects the box.
+                * @retval 2 The node is inside the box.
                 */
-                octree ( const int dimension, const T emptyValue = T()) {
-                        this->_root = NULL;
-                        this->init(dimension, emptyValue);
-                        return;
+                static int overlap ( const int ox, const int oy, const int oz, const int d, const int* box ) {
+                        if ( ox + d - 1 < box[0] || oy + d - 1 < box[1] || oz + d - 1 < box[2] ) return 0;
+                        if ( box[3] < ox || box[4] < oy || box[5] < oz ) return 0;
+                        if ( box[0] <= ox && box[1] <= oy && box[2] <= oz &&
+                             ox + d - 1 <= box[3] && oy + d - 1 <= box[4] && oz + d - 1 <= box[5] ) return 2;
+                        return 1;
                 }
 
                 /**
-                * @brief Destructor
+                * @brief set value to the voxels of a subtree in the box.
                 */
-                virtual ~octree ( void ) {
-                        if ( this->_root != NULL ) delete _root;
+                void fill_node ( node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz, const int* box, const T& v ) {
+                        const int d = 1 << level;
+                        const int state = overlap( ox, oy, oz, d, box );
+                        if ( state == 0 ) return;
+                        if ( state == 2 ) {
+#ifdef MI_OCTREE_PROFILE
+                                if ( !nd.is_leaf() ) this->_shared->allocator.count_merge();
+#endif
+                                nd.remove_child( this->_shared->allocator );
+                                nd.set_value( v );
+                                return;
+                        }
+                        nd.create_child( this->_shared->allocator );
+                        node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->fill_node( child[i], level - 1, ox + d/2 * ( i & 1 ), oy + d/2 * ( ( i >> 1 ) & 1 ), oz + d/2 * ( ( i >> 2 ) & 1 ), box, v );
+                        }
+                        std::vector<typename node<T>::handle> freed;
+                        if ( nd.merge_uniform( this->_shared->allocator, freed ) == 0 ) {
+                                if ( this->_reduce != NULL ) nd.mark_stale();
+                                this->update_node( nd, level );
+                        }
+                        for ( size_t i = 0 ; i < freed.size() ; ++i ) this->_shared->allocator.deallocate( freed[i] );
                         return;
                 }
+
                 /**
-                * @param[in] dimension dimension of the octree
-                * @param[in] emptyValue the default value of the octree
+                * @brief visit leaves of a subtree intersecting the box.
                 */
-                void init(const int dimension, const T emptyValue) {
-                        if (this->_root != NULL) delete this->_root;
-                        this->_level      = this->get_level(dimension);
-                        this->_dimension  = static_cast<int>(pow(2.0, this->_level));
-                        this->_emptyValue = emptyValue;
-                        this->_root = new node<T>( this->_level, this->_emptyValue);
+                template < typename Function >
+                void for_each_node ( const node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz, const int* box, Function& func ) const {
+                        const int d = 1 << level;
+                        if ( overlap( ox, oy, oz, d, box ) == 0 ) return;
+                        if ( nd.is_leaf() ) {
+                                func( ox, oy, oz, d, nd.value() );
+                                return;
+                        }
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->for_each_node( child[i], level - 1, ox + d/2 * ( i & 1 ), oy + d/2 * ( ( i >> 1 ) & 1 ), oz + d/2 * ( ( i >> 2 ) & 1 ), box, func );
+                        }
                         return;
                 }
 
                 /**
-                * @brief get value at (x, y, z)
-                * @param[in] x x-coordinate
-                * @param[in] y y-coordinate
-                * @param[in] z z-coordinate
-                * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                * @brief a subtree with its level and origin.
                 */
-                T get (const int x, const int y, const int z) const {
-                        return this->is_valid(x,y,z) ?
-                               this->_root->get( x, y, z ) : this->_emptyValue;
+                struct subtree {
+                        const node<T>* nd;
+                        unsigned char level;
+                        int ox, oy, oz;
+                };
+
+                /**
+                * @brief collect nodes at the given depth and leaves above it.
+                */
+                void collect_leaf_tasks ( const node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz,
+                                          const unsigned char depth, std::vector<subtree>& nodes ) const {
+                        if ( depth == 0 || nd.is_leaf() ) {
+                                const subtree s = { &nd, level, ox, oy, oz };
+                                nodes.push_back( s );
+                                return;
+                        }
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        const int d = 1 << ( level - 1 );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->collect_leaf_tasks( child[i], level - 1, ox + d * ( i & 1 ), oy + d * ( ( i >> 1 ) & 1 ), oz + d * ( ( i >> 2 ) & 1 ), depth - 1, nodes );
+                        }
+                        return;
                 }
 
                 /**
-                * @brief set value at (x, y, z)
-                * @param[in] x x-coordinate
-                * @param[in] y y-coordinate
-                * @param[in] z z-coordinate
-                * @param[in] v value
-                * @note do nothing if (x,y,z) is invalid.
+                * @brief call func for every leaf of a subtree.
                 */
-                void set (const int x, const int y, const int z, const T v) {
-                        if ( this->is_valid(x,y,z) ) {
-                                this->_root->set( x, y, z, v );
+                template < typename Function >
+                void for_each_leaf_node ( const node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz,
+                                          const bool skipEmpty, Function& func ) const {
+                        if ( nd.is_leaf() ) {
+                                if ( skipEmpty && nd.value() == this->_emptyValue ) return;
+                                const leaf l = { ox, oy, oz, 1 << level, nd.value() };
+                                func( l );
+                                return;
+                        }
+                        if ( skipEmpty && this->is_empty_subtree( nd, level ) ) return;
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        const int d = 1 << ( level - 1 );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->for_each_leaf_node( child[i], level - 1, ox + d * ( i & 1 ), oy + d * ( ( i >> 1 ) & 1 ), oz + d * ( ( i >> 2 ) & 1 ), skipEmpty, func );
                         }
                         return;
                 }
 
                 /**
-                * @brief check (x, y, z) is valid
-                * @param[in] x x-coordinate
-                * @param[in] y y-coordinate
-                * @param[in] z z-coordinate
-                * @retval true (x, y, z) is valid
-                * @retval false (x, y, z) is invalid
+                * @return floor(v) clamped to [mn, mx].
                 */
-                bool is_valid (const int x, const int y, const int z) const {
-                        if ( x < 0 ) return false;
-                        if ( y < 0 ) return false;
-                        if ( z < 0 ) return false;
-                        if ( this->getDimension() <= x ) return false;
-                        if ( this->getDimension() <= y ) return false;
-                        if ( this->getDimension() <= z ) return false;
-                        return true;
+                static int clamp_floor ( const double v, const int mn, const int mx ) {
+                        if ( !( mn < v ) ) return mn;
+                        if ( !( v < mx ) ) return mx;
+                        return static_cast<int>( std::floor( v ) );
                 }
 
                 /**
-                * @brief check (x, y, z) is empty
-                * @param[in] x x-coordinate
-                * @param[in] y y-coordinate
-                * @param[in] z z-coordinate
-                * @retval true (x, y, z) is empty
-                * @retval false (x, y, z) is not empty
+                * @brief a subtree in the queue of nearest().
                 */
-                bool is_empty ( const int x, const int y, const int z) {
-                        return this->get(x, y, z) == this->_emptyValue;
+                struct candidate {
+                        int64_t d2; ///< Squared distance to the cube.
+                        const node<T>* nd;
+                        unsigned char level;
+                        int ox, oy, oz;
+                        bool operator > ( const candidate& that ) const {
+                                return this->d2 > that.d2;
+                        }
+                };
+
+                /**
+                * @return squared distance from (x, y, z) to the cube (ox, oy, oz) - (ox + d - 1, oy + d - 1, oz + d - 1).
+                */
+                static int64_t cube_distance2 ( const int x, const int y, const int z, const int ox, const int oy, const int oz, const int d ) {
+                        const int64_t dx = ( x < ox ) ? ox - x : ( ( ox + d - 1 < x ) ? x - ( ox + d - 1 ) : 0 );
+                        const int64_t dy = ( y < oy ) ? oy - y : ( ( oy + d - 1 < y ) ? y - ( oy + d - 1 ) : 0 );
+                        const int64_t dz = ( z < oz ) ? oz - z : ( ( oz + d - 1 < z ) ? z - ( oz + d - 1 ) : 0 );
+                        return dx * dx + dy * dy + dz * dz;
                 }
 
                 /**
-                * @brief get bounding box (mnx, mny, mnz) - (mxx, mxy, mxz)
-                * @param[out] mnx minimum x-coordinate
-                * @param[out] mny minimum y-coordinate
-                * @param[out] mnz minimum z-coordinate
-                * @param[out] mxx maximum x-coordinate
-                * @param[out] mxy maximum y-coordinate
-                * @param[out] mxz maximum z-coordinate
-                * @param[in] optimized if true, get bounding box of non-empty cells
+                * @brief append non-empty voxels of a subtree within the sphere.
                 */
-                void boundingbox (int& mnx, int& mny, int& mnz,  int& mxx, int& mxy, int& mxz,              bool optimized = true) {
-                        if (optimized) {
-                                this->_root->boundingbox( this->_emptyValue, mnx, mny, mnz, mxx, mxy, mxz);
-                        } else {
-                                mnx = mny = mnz = 0;
-                                mxx = mxy = mxz = this->_dimension - 1;
+                void radius_node ( const node<T>& nd, const unsigned char level, const int ox, const int oy, const int oz,
+                                   const int x, const int y, const int z, const double r2, std::vector<voxel>& out ) const {
+                        const int d = 1 << level;
+                        if ( r2 < static_cast<double>( cube_distance2( x, y, z, ox, oy, oz, d ) ) ) return;
+                        if ( nd.is_leaf() ) {
+                                if ( nd.value() == this->_emptyValue ) return;
+                                voxel v;
+                                v.value = nd.value();
+                                // only the rows within the bounding box of the sphere are visited.
+                                const double reach = std::floor( std::sqrt( r2 ) ) + 1;
+                                const int mnz = static_cast<int>( std::max( double( oz ), z - reach ) ), mxz = static_cast<int>( std::min( double( oz + d - 1 ), z + reach ) );
+                                const int mny = static_cast<int>( std::max( double( oy ), y - reach ) ), mxy = static_cast<int>( std::min( double( oy + d - 1 ), y + reach ) );
+                                const int64_t limit = int64_t( this->_dimension ) * 2; // wider than any leaf
+                                for ( v.z = mnz ; v.z <= mxz ; ++v.z ) {
+                                        for ( v.y = mny ; v.y <= mxy ; ++v.y ) {
+                                                const double rest = r2 - double( v.y - y ) * ( v.y - y ) - double( v.z - z ) * ( v.z - z );
+                                                if ( rest < 0 ) continue;
+                                                int64_t w = static_cast<int64_t>( std::min( std::sqrt( rest ), double( limit ) ) );
+                                                while ( rest < double( w ) * w ) --w;
+                                                while ( w < limit && double( w + 1 ) * ( w + 1 ) <= rest ) ++w;
+                                                const int mn = static_cast<int>( std::max( int64_t( ox ), x - w ) ), mx = static_cast<int>( std::min( int64_t( ox ) + d - 1, x + w ) );
+                                                for ( v.x = mn ; v.x <= mx ; ++v.x ) out.push_back( v );
+                                        }
+                                }
+                                return;
+                        }
+                        if ( this->is_empty_subtree( nd, level ) ) return;
+                        const node<T>* child = nd.children( this->_shared->allocator );
+                        for ( int i = 0 ; i < 8 ; ++i ) {
+                                this->radius_node( child[i], level - 1, ox + d/2 * ( i & 1 ), oy + d/2 * ( ( i >> 1 ) & 1 ), oz + d/2 * ( ( i >> 2 ) & 1 ), x, y, z, r2, out );
                         }
                         return;
                 }
 
+                static unsigned char const MAX_MORTON_LEVEL = morton_code::MAX_LEVEL; ///< 3 * 21 bits fit in a 64-bit Morton code.
+                static_assert( MAX_LEVEL <= MAX_MORTON_LEVEL, "every octree level must fit in a Morton code and in path[MAX_MORTON_LEVEL + 1]" );
+
                 /**
-                * @param[in] value The value which you count.
-                * @return the nuber of voxels with the value.
+                * @param[in] prev Morton code of the previous point
+                * @param[in] key Morton code of the current point
+                * @param[in] reached the level where the previous descent stopped
+                * @return the level of the deepest node shared by both points.
                 */
-                size_t count( const T value ) const {
-                        return this->_root->count(value);
+                static unsigned char restart_level ( const uint64_t prev, const uint64_t key, const unsigned char reached ) {
+                        uint64_t diff = prev ^ key;
+                        unsigned char l = 0;
+                        while ( diff != 0 ) {
+                                diff >>= 3;
+                                ++l;
+                        }
+                        return l > reached ? l : reached;
                 }
 
                 /**
-                * @param[in] opt optimized or not. if false, do nothing.
+                * @brief release all nodes.
+                * @note The tree is walked only if the allocator cannot release
+                * everything at once or T has a non-trivial destructor.
                 */
-                void optimize ( const bool opt = true ) {
-                        if ( opt ) _root->optimize();
+                void release ( void ) {
+                        ++this->_generation;
+                        if ( this->_shared == NULL ) return; // moved out (no nodes).
+                        if ( this->_snapshot ) {
+                                // the owner may be allocating in another thread, so a snapshot only
+                                // drops its reference and leaves deallocation to the owner.
+                                std::lock_guard<std::mutex> lock( this->_shared->mutex );
+                                if ( this->_root != NULL && !this->_root->is_leaf() ) {
+                                        const typename node<T>::handle h = this->_root->get_handle();
+                                        if ( !this->_shared->owner ) {
+                                                this->_root->remove_child( this->_shared->allocator );
+                                        } else if ( this->_root->get_block( this->_shared->allocator )->_refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+                                                this->_shared->garbage.push_back( h );
+                                                this->_shared->pending.store( true, std::memory_order_release );
+                                        }
+                                }
+                                delete this->_root;
+                                this->_root = NULL;
+                                return;
+                        }
+                        const bool shared = this->has_snapshots();
+                        this->collect_garbage();
+                        if ( this->_root != NULL ) {
+                                if ( shared || !node<T>::allocator_type::bulk_release || !std::is_trivially_destructible<T>::value ) {
+                                        this->_root->remove_child(this->_shared->allocator);
+                                }
+                                delete this->_root;
+                                this->_root = NULL;
+                        }
+                        if ( !shared ) this->_shared->allocator.clear();
                         return;
                 }
 
                 /**
-                * @return a dimension of the octree. It must be a 2^n.
+                * @brief release all nodes and, for the writable octree, hand the blocks shared with snapshots over to them.
                 */
-                int getDimension ( void ) const {
-                        return this->_dimension;
+                void destroy ( void ) {
+                        this->release();
+                        if ( this->_shared == NULL ) return;
+                        if ( this->_snapshot ) {
+                                this->_shared->snapshots.fetch_sub( 1, std::memory_order_release ); // after pushing garbage in release().
+                        } else {
+                                // from now on snapshots deallocate their blocks by themselves.
+                                std::lock_guard<std::mutex> lock( this->_shared->mutex );
+                                this->_shared->owner = false;
+                                this->destroy_garbage();
+                        }
+                        return;
                 }
 
                 /**
-                * @return empty value of the octree.
+                * @brief leave a moved octree empty without an allocator (_shared is NULL).
                 */
-                T getEmptyValue( void ) const {
-                        return this->_emptyValue;
+                void reset_moved ( void ) noexcept {
+                        this->_level = 0;
+                        this->_dimension = 0;
+                        this->_root = NULL;
+                        ++this->_generation;
+                        this->_snapshot = false;
+                        this->_dirty.clear();
+                        this->_journal = false;
+                        this->_journalAll = false;
+                        this->_reduce = NULL;
+                        return;
                 }
 
                 /**
-                * @param[in] fin input file stream
-                * @retval true Succeeded.
-                * @retval false Failed.
+                * @brief deallocate blocks released by snapshots and invalidate accessors if snapshots exist.
                 */
-                bool read ( std::ifstream& fin ) {
-                        int dimension;
-                        T emptyValue;
-                        fin.read ( (char*)&dimension , sizeof(int) );
-                        fin.read ( (char*)&emptyValue, sizeof(T) );
-                        this->init(dimension, emptyValue);
-                        if (fin.fail()) return false;
-                        return this->_root->read(fin);
+                void prepare_write ( void ) {
+                        this->collect_garbage();
+                        if ( this->has_snapshots() ) ++this->_generation; // paths may be copied.
+                        return;
                 }
+
                 /**
-                * @param[in] fout output file stream
-                * @retval true Succeeded.
-                * @retval false Failed.
+                * @retval true Snapshots share the blocks.
+                * @retval false No snapshot is alive. Blocks released by the last ones are seen by collect_garbage().
                 */
-                bool write ( std::ofstream& fout ) {
-                        if ( fout.fail() ) return false;
-                        fout.write ( (char*)&_dimension , sizeof(int) );
-                        fout.write ( (char*)&_emptyValue, sizeof(T) );
-                        if ( fout.fail() ) return false;
-                        return this->_root->write(fout);
+                bool has_snapshots ( void ) const {
+                        return this->_shared != NULL && this->_shared->snapshots.load( std::memory_order_acquire ) != 0;
                 }
-        private:
+
+                void collect_garbage ( void ) {
+                        if ( this->_shared == NULL || !this->_shared->pending.load( std::memory_order_acquire ) ) return;
+                        std::lock_guard<std::mutex> lock( this->_shared->mutex );
+                        this->destroy_garbage();
+                        return;
+                }
+
+                /**
+                * @note the caller holds _shared->mutex.
+                */
+                void destroy_garbage ( void ) {
+                        for ( size_t i = 0 ; i < this->_shared->garbage.size() ; ++i ) {
+                                node<T>::destroy_block( this->_shared->garbage[i], this->_shared->allocator );
+                        }
+                        this->_shared->garbage.clear();
+                        this->_shared->pending.store( false, std::memory_order_relaxed );
+                        return;
+                }
+
+                /**
+                * @brief construct a snapshot sharing the blocks of that.
+                */
+                octree ( const octree& that, snapshot_tag )
+                        : _level( that._level ), _dimension( that._dimension ), _emptyValue( that._emptyValue ), _root( that._root != NULL ? new node<T>( *(that._root) ) : NULL ),
+                          _shared( that._shared ), _generation(0), _snapshot(true),
+                          _dirtyLimit(0), _journalLevel(0), _journal(false), _journalAll(false), _reduce( that._reduce ) {
+                        if ( this->_shared == NULL ) this->_shared.reset( new shared_state() ); // that was moved out.
+                        this->_shared->snapshots.fetch_add( 1, std::memory_order_relaxed );
+                        if ( this->_root != NULL && !this->_root->is_leaf() ) this->_root->get_block( this->_shared->allocator )->_refs.fetch_add( 1, std::memory_order_relaxed );
+                        return;
+                }
+
                 /**
                 * @brief get the maximum level of the octree
                 * @param[in] dimension dimension of the octree
@@ -516,12 +4042,18 @@ namespace mi
                 */
                 unsigned char get_level( const int dimension) const {
                         int x = 1;
-                        for (unsigned char i = 0 ; i < 0xFF ; i++) {
+                        for (unsigned char i = 0 ; i < MAX_LEVEL ; i++) {
                                 if ( dimension <= x) return i;
                                 x *= 2;
                         }
-                        return 0;
+                        return MAX_LEVEL;
                 }
         };
+
+        template < typename T, template < typename > class Allocator, typename Statistics >
+        char const* const octree<T, Allocator, Statistics>::COMPRESSED_MAGIC = "MIOZ";
+
+        template < typename T, template < typename > class Allocator, typename Statistics >
+        char const* const octree<T, Allocator, Statistics>::DELTA_MAGIC = "MIOD";
 };
 #endif// __OCTREE_HPP__
@@ -0,0 +1,1188 @@
+/*
+
+Copyright (c) 2009, Takashi Michikawa
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of RCAST, The University of Tokyo nor the names of its
+contributors may be used to endorse or promote products derived from
+this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include "octree.hpp"
+#include "octree_view.hpp"
+#include "concurrent_octree.hpp"
+#include "brick_octree.hpp"
+#include "octree_grid.hpp"
+#include "linear_octree.hpp"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <sstream>
+#include <sys/resource.h>
+// compile : g++ -O3 -std=c++11 octree_bench.cpp
+
+/**
+* @brief Reproducible pseudo random numbers (xorshift32).
+*/
+class random_number
+{
+private:
+        uint32_t _state;
+public:
+        explicit random_number ( const uint32_t seed ) : _state(seed) {
+                return;
+        }
+        int next ( const int n ) {
+                this->_state ^= this->_state << 13;
+                this->_state ^= this->_state >> 17;
+                this->_state ^= this->_state << 5;
+                return static_cast<int>( this->_state % static_cast<uint32_t>(n) );
+        }
+};
+
+/**
+* @brief Timer reporting elapsed nanoseconds.
+*/
+class stop_watch
+{
+private:
+        std::chrono::steady_clock::time_point _start;
+public:
+        stop_watch ( void ) : _start( std::chrono::steady_clock::now() ) {
+                return;
+        }
+        double ns ( void ) const {
+                return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - this->_start ).count();
+        }
+};
+
+/**
+* @brief Timings of batches of operations, reported as ops/s and ns/op percentiles.
+*/
+class latency
+{
+private:
+        std::vector<double> _samples; ///< ns/op of each batch
+        double _ns;
+        double _ops;
+public:
+        latency ( void ) : _ns(0), _ops(0) {
+                return;
+        }
+        void add ( const double ns, const int ops ) {
+                this->_samples.push_back( ns / ops );
+                this->_ns += ns;
+                this->_ops += ops;
+                return;
+        }
+        double percentile ( const double q ) const {
+                std::vector<double> s( this->_samples );
+                std::sort( s.begin(), s.end() );
+                return s[ std::min( s.size() - 1, static_cast<size_t>( q * s.size() ) ) ];
+        }
+        void print ( std::ostream& out, const char* name ) const {
+                if ( this->_samples.empty() ) return;
+                out<<"\t"<<name<<" "<<this->_ops / this->_ns * 1e3<<" Mops/s (p50 "<<this->percentile(0.5)
+                   <<", p90 "<<this->percentile(0.9)<<", p99 "<<this->percentile(0.99)<<" ns/op)";
+                return;
+        }
+};
+
+/**
+* @return peak resident set size of the process in KiB.
+*/
+long peak_rss ( void )
+{
+        struct rusage usage;
+        ::getrusage( RUSAGE_SELF, &usage );
+        return usage.ru_maxrss;
+}
+
+template < template < typename > class Allocator >
+void bench_lookup ( const char* name, const int dimension, const int points, const int lookups )
+{
+        mi::octree<int, Allocator> tree(dimension, 0);
+        random_number rnd(12345);
+        stop_watch fill;
+        for ( int i = 0 ; i < points ; ++i ) {
+                const int x = rnd.next(dimension);
+                const int y = rnd.next(dimension);
+                const int z = rnd.next(dimension);
+                tree.set(x, y, z, i + 1);
+        }
+        const double fill_ns = fill.ns();
+
+        std::vector<int> xyz( 3 * static_cast<size_t>(lookups) );
+        for ( size_t i = 0 ; i < xyz.size() ; ++i ) xyz[i] = rnd.next(dimension);
+
+        long long sum = 0;
+        stop_watch random_access;
+        for ( int i = 0 ; i < lookups ; ++i ) {
+                sum += tree.get(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+        }
+        const double random_ns = random_access.ns();
+
+        const int side = static_cast<int>( std::cbrt( static_cast<double>(lookups) ) );
+        stop_watch coherent_access;
+        for ( int z = 0 ; z < side ; ++z ) {
+                for ( int y = 0 ; y < side ; ++y ) {
+                        for ( int x = 0 ; x < side ; ++x ) {
+                                sum += tree.get(x, y, z);
+                        }
+                }
+        }
+        const double coherent_ns = coherent_access.ns();
+
+        std::cout<<name<<"\tset "<<fill_ns / points<<" ns/op"
+                 <<"\trandom get "<<random_ns / lookups<<" ns/lookup"
+                 <<"\tcoherent get "<<coherent_ns / ( static_cast<double>(side) * side * side )<<" ns/lookup"
+                 <<"\t"<<tree.bytes_used() / 1024<<" KiB"
+                 <<"\t(checksum "<<sum<<")"<<std::endl;
+        return;
+}
+
+template < template < typename > class Allocator >
+void bench_batch ( const char* name, const int dimension, const int points, const int lookups )
+{
+        mi::octree<int, Allocator> tree(dimension, 0);
+        random_number rnd(12345);
+        std::vector<int> xyz( 3 * static_cast<size_t>(points) );
+        std::vector<int> values( points );
+        for ( size_t i = 0 ; i < xyz.size() ; ++i ) xyz[i] = rnd.next(dimension);
+        for ( int i = 0 ; i < points ; ++i ) values[i] = i + 1;
+        stop_watch fill;
+        tree.set_batch(&xyz[0], points, &values[0]);
+        const double fill_ns = fill.ns();
+
+        xyz.resize( 3 * static_cast<size_t>(lookups) );
+        for ( size_t i = 0 ; i < xyz.size() ; ++i ) xyz[i] = rnd.next(dimension);
+        std::vector<int> out( lookups );
+
+        long long sum = 0;
+        stop_watch scalar;
+        for ( int i = 0 ; i < lookups ; ++i ) {
+                sum += tree.get(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+        }
+        const double scalar_ns = scalar.ns();
+
+        stop_watch batch;
+        tree.get_batch(&xyz[0], lookups, &out[0]);
+        const double batch_ns = batch.ns();
+        for ( int i = 0 ; i < lookups ; ++i ) sum -= out[i];
+
+        std::cout<<name<<"	set_batch "<<fill_ns / points<<" ns/op"
+                 <<"	scalar get "<<lookups / scalar_ns * 1e3<<" M lookups/s"
+                 <<"	get_batch "<<lookups / batch_ns * 1e3<<" M lookups/s"
+                 <<"	(difference "<<sum<<")"<<std::endl;
+        return;
+}
+
+void bench_dense ( const int dimension )
+{
+        // dense sphere with a noisy shell
+        std::vector<int> data( static_cast<size_t>(dimension) * dimension * dimension );
+        random_number rnd(12345);
+        const int c = dimension / 2;
+        for ( int z = 0 ; z < dimension ; ++z ) {
+                for ( int y = 0 ; y < dimension ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) {
+                                const int r2 = ( x - c ) * ( x - c ) + ( y - c ) * ( y - c ) + ( z - c ) * ( z - c );
+                                int v = ( r2 < c * c / 4 ) ? 1 : 0;
+                                if ( r2 < c * c / 4 && c * c / 4 - r2 < 4 * c ) v += rnd.next(3);
+                                data[ x + static_cast<size_t>(dimension) * ( y + static_cast<size_t>(dimension) * z ) ] = v;
+                        }
+                }
+        }
+
+        stop_watch serial;
+        mi::octree<int, mi::pool_allocator> reference(dimension, 0);
+        for ( int z = 0 ; z < dimension ; ++z ) {
+                for ( int y = 0 ; y < dimension ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) {
+                                reference.set(x, y, z, data[ x + static_cast<size_t>(dimension) * ( y + static_cast<size_t>(dimension) * z ) ]);
+                        }
+                }
+        }
+        std::cout<<"dense "<<dimension<<"^3	set() loop "<<serial.ns() * 1e-6<<" ms	"<<reference.bytes_used() / 1024<<" KiB"<<std::endl;
+
+        const unsigned int hardware = std::max( 1u, std::thread::hardware_concurrency() );
+        for ( unsigned int threads = 1 ; ; threads *= 2 ) {
+                if ( threads > hardware ) threads = hardware;
+                stop_watch build;
+                mi::octree<int, mi::pool_allocator> tree;
+                tree.build_from_dense( &data[0], dimension, dimension, dimension, 0, threads );
+                std::cout<<"dense "<<dimension<<"^3	build_from_dense "<<threads<<" threads "<<build.ns() * 1e-6<<" ms	"<<tree.bytes_used() / 1024<<" KiB"<<std::endl;
+                if ( threads == hardware ) break;
+        }
+        return;
+}
+
+void bench_load ( const int dimension, const int points )
+{
+        mi::octree<int, mi::pool_allocator> tree(dimension, 0);
+        random_number rnd(12345);
+        for ( int i = 0 ; i < points ; ++i ) {
+                tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), i + 1);
+        }
+        std::ofstream fout("bench.oct", std::ios::binary);
+        tree.write(fout);
+        fout.close();
+        std::ofstream flat("bench_flat.oct", std::ios::binary);
+        tree.write_flat(flat);
+        flat.close();
+
+        stop_watch write_packed;
+        std::ofstream packed("bench_packed.oct", std::ios::binary);
+        tree.write_compressed(packed);
+        const long long packed_size = packed.tellp();
+        packed.close();
+        const double write_packed_ns = write_packed.ns();
+
+        stop_watch read_packed;
+        mi::octree<int, mi::pool_allocator> unpacked;
+        std::ifstream packed_in("bench_packed.oct", std::ios::binary);
+        unpacked.read(packed_in);
+        const double read_packed_ns = read_packed.ns();
+        std::cout<<"block format	"<<packed_size / 1024<<" KiB	write_compressed() "<<write_packed_ns * 1e-6<<" ms	read() "<<read_packed_ns * 1e-6<<" ms"<<std::endl;
+
+        std::ifstream legacy("bench.oct", std::ios::binary | std::ios::ate);
+        std::cout<<"original format\t"<<legacy.tellg() / 1024<<" KiB"<<std::endl;
+        stop_watch read;
+        mi::octree<int, mi::pool_allocator> loaded;
+        std::ifstream fin("bench.oct", std::ios::binary);
+        loaded.read(fin);
+        const int v0 = loaded.get(0, 0, 0);
+        const double read_ns = read.ns();
+
+        stop_watch map;
+        mi::octree_view<int> view("bench_flat.oct");
+        const int v1 = view.get(0, 0, 0);
+        const double map_ns = map.ns();
+
+        std::cout<<"load	read() "<<read_ns * 1e-6<<" ms	octree_view "<<map_ns * 1e-6<<" ms	(values "<<v0<<", "<<v1<<")"<<std::endl;
+        std::remove("bench.oct");
+        std::remove("bench_flat.oct");
+        std::remove("bench_packed.oct");
+        return;
+}
+
+void bench_fill ( const int dimension )
+{
+        mi::octree<int, mi::pool_allocator> tree(dimension, 0);
+        const int half = dimension / 2;
+        stop_watch fill;
+        tree.fill_box(0, 0, 0, half - 1, half - 1, half - 1, 1);
+        const double fill_ns = fill.ns();
+        stop_watch unaligned;
+        tree.fill_box(1, 1, 1, half, half, half, 2);
+        const double unaligned_ns = unaligned.ns();
+
+        size_t leaves = 0;
+        stop_watch visit;
+        tree.for_each_in_box(0, 0, 0, half, half, half, [&leaves] ( int, int, int, int, int ) { ++leaves; });
+        const double visit_ns = visit.ns();
+        std::cout<<"fill_box "<<half<<"^3	aligned "<<fill_ns * 1e-3<<" us	unaligned "<<unaligned_ns * 1e-3<<" us"
+                 <<"	for_each_in_box "<<leaves<<" leaves "<<visit_ns * 1e-3<<" us"<<std::endl;
+        return;
+}
+
+void bench_leaves ( const int dimension, const int points )
+{
+        mi::octree<int, mi::pool_allocator> tree(dimension, 0);
+        random_number rnd(12345);
+        for ( int i = 0 ; i < points ; ++i ) {
+                tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+        }
+
+        size_t leaves = 0;
+        stop_watch iterate;
+        for ( mi::octree<int, mi::pool_allocator>::leaf_iterator it = tree.leaf_begin(true) ; it != tree.leaf_end() ; ++it ) ++leaves;
+        const double iterate_ns = iterate.ns();
+
+        std::atomic<size_t> parallel_leaves(0);
+        stop_watch parallel;
+        tree.parallel_for_each_leaf([&parallel_leaves] ( const mi::octree<int, mi::pool_allocator>::leaf& ) { ++parallel_leaves; }, true);
+        const double parallel_ns = parallel.ns();
+
+        size_t recursive_leaves = 0;
+        stop_watch recursive;
+        tree.for_each_in_box(0, 0, 0, dimension - 1, dimension - 1, dimension - 1, [&recursive_leaves] ( int, int, int, int, int value ) {
+                if ( value != 0 ) ++recursive_leaves;
+        });
+        const double recursive_ns = recursive.ns();
+        std::cout<<"leaf export "<<leaves<<" leaves	leaf_iterator "<<iterate_ns * 1e-6<<" ms	parallel_for_each_leaf "
+                 <<parallel_leaves<<" leaves "<<parallel_ns * 1e-6<<" ms	for_each_in_box "<<recursive_leaves<<" leaves "<<recursive_ns * 1e-6<<" ms"<<std::endl;
+        return;
+}
+
+void bench_concurrent ( const int dimension, const int points )
+{
+        for ( unsigned int threads = 1 ; threads <= 64 ; threads *= 2 ) {
+                const int slab = std::max( 1, dimension / static_cast<int>(threads) );
+                const int share = points / static_cast<int>(threads);
+
+                mi::concurrent_octree<int> tree(dimension, 0);
+                std::vector<std::thread> pool;
+                stop_watch concurrent;
+                for ( unsigned int t = 0 ; t < threads ; ++t ) {
+                        pool.push_back( std::thread( [&tree, t, slab, share, dimension] ( void ) {
+                                random_number rnd(12345 + t);
+                                for ( int i = 0 ; i < share ; ++i ) {
+                                        tree.set(( t * slab + rnd.next(slab) ) % dimension, rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+                                }
+                        } ) );
+                }
+                for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+                const double concurrent_ns = concurrent.ns();
+
+                mi::octree<int, mi::pool_allocator> locked(dimension, 0);
+                std::mutex mutex;
+                pool.clear();
+                stop_watch global;
+                for ( unsigned int t = 0 ; t < threads ; ++t ) {
+                        pool.push_back( std::thread( [&locked, &mutex, t, slab, share, dimension] ( void ) {
+                                random_number rnd(12345 + t);
+                                for ( int i = 0 ; i < share ; ++i ) {
+                                        const int x = ( t * slab + rnd.next(slab) ) % dimension;
+                                        const int y = rnd.next(dimension);
+                                        const int z = rnd.next(dimension);
+                                        std::lock_guard<std::mutex> lock(mutex);
+                                        locked.set(x, y, z, 1 + i % 7);
+                                }
+                        } ) );
+                }
+                for ( size_t i = 0 ; i < pool.size() ; ++i ) pool[i].join();
+                const double global_ns = global.ns();
+                std::cout<<"concurrent set "<<threads<<" threads	concurrent_octree "<<share * threads / ( concurrent_ns * 1e-9 ) * 1e-6<<" Mops/s"
+                         <<" ("<<tree.collisions()<<" collisions)	global mutex "<<share * threads / ( global_ns * 1e-9 ) * 1e-6<<" Mops/s"<<std::endl;
+        }
+        return;
+}
+
+void bench_accessor ( const int dimension )
+{
+        mi::octree<int, mi::pool_allocator> tree(dimension, 0);
+        random_number rnd(12345);
+        for ( int i = 0 ; i < dimension * dimension ; ++i ) {
+                tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+        }
+        const int n = std::min( dimension, 128 );
+        long long sum = 0;
+        stop_watch plain;
+        for ( int z = 0 ; z < n ; ++z ) {
+                for ( int y = 0 ; y < n ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) sum += tree.get(x, y, z);
+                }
+        }
+        const double plain_ns = plain.ns();
+
+        long long cached_sum = 0;
+        mi::octree<int, mi::pool_allocator>::accessor acc(tree);
+        stop_watch cached;
+        for ( int z = 0 ; z < n ; ++z ) {
+                for ( int y = 0 ; y < n ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) cached_sum += acc.get(x, y, z);
+                }
+        }
+        const double cached_ns = cached.ns();
+        const double count = static_cast<double>(n) * n * dimension;
+        std::cout<<"scan-line sweep	get() "<<plain_ns / count<<" ns/op	accessor "<<cached_ns / count<<" ns/op"
+                 <<"	(sums "<<sum<<", "<<cached_sum<<")"<<std::endl;
+
+        // a filter output written back in scan-line order (the first pass splits the leaves).
+        mi::octree<int, mi::pool_allocator>::accessor out(tree);
+        for ( int z = 0 ; z < n ; ++z ) {
+                for ( int y = 0 ; y < n ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) out.set(x, y, z, 1);
+                }
+        }
+        stop_watch plain_write;
+        for ( int z = 0 ; z < n ; ++z ) {
+                for ( int y = 0 ; y < n ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) tree.set(x, y, z, ( x ^ y ^ z ) & 3);
+                }
+        }
+        const double plain_write_ns = plain_write.ns();
+        stop_watch cached_write;
+        for ( int z = 0 ; z < n ; ++z ) {
+                for ( int y = 0 ; y < n ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) out.set(x, y, z, ( x + y + z ) & 3);
+                }
+        }
+        const double cached_write_ns = cached_write.ns();
+        std::cout<<"scan-line sweep	set() "<<plain_write_ns / count<<" ns/op	accessor "<<cached_write_ns / count<<" ns/op"
+                 <<"	(value "<<tree.get(n - 1, n - 1, n - 1)<<")"<<std::endl;
+        return;
+}
+
+void bench_snapshot ( const int dimension, const int points )
+{
+        typedef mi::octree<int, mi::pool_allocator> Tree;
+        Tree tree(dimension, 0);
+        random_number rnd(12345);
+        for ( int i = 0 ; i < points ; ++i ) {
+                tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+        }
+        const size_t base = tree.get_allocator().live_blocks();
+        const int writes = std::max( points / 100, 1 );
+
+        stop_watch plain;
+        for ( int i = 0 ; i < writes ; ++i ) tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+        const double plain_ns = plain.ns();
+
+        const int snaps = 100;
+        std::vector<std::shared_ptr<const Tree> > history;
+        double snapshot_ns = 0;
+        stop_watch cow;
+        for ( int s = 0 ; s < snaps ; ++s ) {
+                stop_watch take;
+                history.push_back( tree.snapshot() );
+                snapshot_ns += take.ns();
+                for ( int i = 0 ; i < writes / snaps ; ++i ) tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+        }
+        const double cow_ns = cow.ns() - snapshot_ns;
+        const size_t copied = tree.get_allocator().live_blocks() - base;
+        history.clear();
+        tree.set(0, 0, 0, 1);
+        std::cout<<"snapshot "<<snapshot_ns / snaps<<" ns	set() "<<plain_ns / writes<<" ns/op	set() under "<<snaps<<" snapshots "
+                 <<cow_ns / ( writes / snaps * snaps )<<" ns/op	"<<copied<<" blocks copied for "<<writes / snaps * snaps<<" writes ("<<base<<" in tree)"<<std::endl;
+        return;
+}
+
+void bench_delta ( const int dimension, const int points )
+{
+        mi::octree<int, mi::pool_allocator> tree(dimension, 0), replica(dimension, 0);
+        random_number rnd(12345);
+        for ( int i = 0 ; i < points ; ++i ) {
+                const int x = rnd.next(dimension), y = rnd.next(dimension), z = rnd.next(dimension);
+                tree.set(x, y, z, 1 + i % 7);
+                replica.set(x, y, z, 1 + i % 7);
+        }
+        std::stringstream full;
+        stop_watch checkpoint;
+        tree.write_compressed(full);
+        const double full_ns = checkpoint.ns();
+        tree.track_changes();
+
+        for ( int changes = 100 ; changes <= 10000 ; changes *= 10 ) {
+                stop_watch tracked;
+                for ( int i = 0 ; i < changes ; ++i ) tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+                const double set_ns = tracked.ns();
+                std::stringstream delta;
+                stop_watch write;
+                tree.write_delta(delta);
+                const double write_ns = write.ns();
+                stop_watch apply;
+                replica.apply_delta(delta);
+                const double apply_ns = apply.ns();
+                std::cout<<"delta of "<<changes<<" sets	"<<delta.str().size() / 1024<<" KiB	write_delta() "<<write_ns * 1e-6<<" ms	apply_delta() "
+                         <<apply_ns * 1e-6<<" ms	tracked set() "<<set_ns / changes<<" ns/op	(full checkpoint "<<full.str().size() / 1024<<" KiB "
+                         <<full_ns * 1e-6<<" ms)"<<std::endl;
+        }
+        return;
+}
+
+void bench_reset ( const int dimension, const int points )
+{
+        const int cycles = 10;
+        mi::octree<int, mi::pool_allocator> tree(dimension, 0);
+        double init_ns = 0, clear_ns = 0;
+        for ( int c = 0 ; c < 2 * cycles ; ++c ) {
+                random_number rnd(12345);
+                stop_watch cycle;
+                if ( c % 2 == 0 ) tree.init(dimension, 0);
+                else tree.clear(0);
+                for ( int i = 0 ; i < points ; ++i ) tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+                ( c % 2 == 0 ? init_ns : clear_ns ) += cycle.ns();
+        }
+
+        // values of 16 floats are copied or moved into the leaves
+        const int n = std::min( points, 50000 );
+        double copy_ns = 0, move_ns = 0;
+        for ( int pass = 0 ; pass < 2 ; ++pass ) {
+                mi::octree< std::vector<float>, mi::pool_allocator > heavy(dimension, std::vector<float>());
+                random_number rnd(12345);
+                stop_watch fill;
+                for ( int i = 0 ; i < n ; ++i ) {
+                        std::vector<float> value( 16, static_cast<float>(i) );
+                        const int x = rnd.next(dimension), y = rnd.next(dimension), z = rnd.next(dimension);
+                        if ( pass == 0 ) heavy.set(x, y, z, value);
+                        else heavy.set(x, y, z, std::move(value));
+                }
+                ( pass == 0 ? copy_ns : move_ns ) = fill.ns();
+        }
+        std::cout<<"refill "<<points<<" points	init() "<<init_ns / cycles * 1e-6<<" ms/cycle	clear() "<<clear_ns / cycles * 1e-6<<" ms/cycle"
+                 <<"	vector<float> set() copy "<<copy_ns / n<<" ns/op	move "<<move_ns / n<<" ns/op"<<std::endl;
+        return;
+}
+
+void bench_lod ( const int dimension, const int points )
+{
+        typedef mi::octree<int, mi::pool_allocator> Tree;
+        Tree plain(dimension, 0), tree(dimension, 0);
+        tree.enable_lod( &Tree::lod_max );
+        double plain_ns = 0, lod_ns = 0;
+        for ( int pass = 0 ; pass < 2 ; ++pass ) {
+                Tree& t = ( pass == 0 ) ? plain : tree;
+                random_number rnd(12345);
+                stop_watch fill;
+                for ( int i = 0 ; i < points ; ++i ) t.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+                ( pass == 0 ? plain_ns : lod_ns ) = fill.ns();
+        }
+        stop_watch update;
+        tree.update_lod();
+        const double update_ns = update.ns();
+
+        // a 64^3 preview: one query per cell at the coarse level
+        int level = 0;
+        while ( ( dimension >> level ) > 64 ) ++level;
+        const int cells = dimension >> level;
+        long long sum = 0;
+        stop_watch fine;
+        for ( int z = 0 ; z < cells ; ++z ) {
+                for ( int y = 0 ; y < cells ; ++y ) {
+                        for ( int x = 0 ; x < cells ; ++x ) sum += plain.get(x << level, y << level, z << level);
+                }
+        }
+        const double fine_ns = fine.ns();
+        stop_watch coarse;
+        for ( int z = 0 ; z < cells ; ++z ) {
+                for ( int y = 0 ; y < cells ; ++y ) {
+                        for ( int x = 0 ; x < cells ; ++x ) sum += tree.get_at_level(x << level, y << level, z << level, static_cast<unsigned char>(level));
+                }
+        }
+        const double coarse_ns = coarse.ns();
+
+        // stale paths are reduced on the fly until update_lod(); a const octree does not store them.
+        random_number rnd(54321);
+        for ( int i = 0 ; i < 1000 ; ++i ) tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 9);
+        const Tree& view = tree;
+        stop_watch unstored;
+        for ( int z = 0 ; z < cells ; ++z ) {
+                for ( int y = 0 ; y < cells ; ++y ) {
+                        for ( int x = 0 ; x < cells ; ++x ) sum += view.get_at_level(x << level, y << level, z << level, static_cast<unsigned char>(level));
+                }
+        }
+        const double unstored_ns = unstored.ns();
+        stop_watch stale;
+        for ( int z = 0 ; z < cells ; ++z ) {
+                for ( int y = 0 ; y < cells ; ++y ) {
+                        for ( int x = 0 ; x < cells ; ++x ) sum += tree.get_at_level(x << level, y << level, z << level, static_cast<unsigned char>(level));
+                }
+        }
+        const double stale_ns = stale.ns();
+        stop_watch stored;
+        for ( int z = 0 ; z < cells ; ++z ) {
+                for ( int y = 0 ; y < cells ; ++y ) {
+                        for ( int x = 0 ; x < cells ; ++x ) sum += tree.get_at_level(x << level, y << level, z << level, static_cast<unsigned char>(level));
+                }
+        }
+        const double stored_ns = stored.ns();
+        stop_watch refresh;
+        tree.update_lod();
+        const double refresh_ns = refresh.ns();
+
+        const double queries = static_cast<double>(cells) * cells * cells;
+        std::cout<<"lod (max)	set "<<plain_ns / points<<" -> "<<lod_ns / points<<" ns/op"
+                 <<"	update_lod() "<<update_ns * 1e-6<<" ms after "<<points<<" sets, "<<refresh_ns * 1e-6<<" ms after 1000"
+                 <<"	"<<cells<<"^3 preview: get() "<<fine_ns / queries<<" ns/query"
+                 <<"	get_at_level("<<level<<") "<<coarse_ns / queries<<" ns/query (stale paths: const "<<unstored_ns / queries
+                 <<", storing "<<stale_ns / queries<<", again "<<stored_ns / queries<<")"
+                 <<"	(checksum "<<sum<<")"<<std::endl;
+        return;
+}
+
+void bench_combine ( const int dimension, const int points )
+{
+        typedef mi::octree<int, mi::pool_allocator> Tree;
+        Tree a(dimension, 0), b(dimension, 0), mask(dimension, 0);
+        random_number rnd(12345);
+        for ( int i = 0 ; i < 64 ; ++i ) {
+                const int x = rnd.next(dimension), y = rnd.next(dimension), z = rnd.next(dimension), s = rnd.next(dimension / 4);
+                a.fill_box(x, y, z, x + s, y + s, z + s, 1 + i % 3);
+        }
+        for ( int i = 0 ; i < points ; ++i ) {
+                a.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 4);
+                b.set(rnd.next(dimension / 2), rnd.next(dimension / 2), rnd.next(dimension / 2), 5);
+        }
+        mask.fill_box(0, 0, 0, dimension / 2 - 1, dimension - 1, dimension - 1, 1);
+
+        // voxel loop over the domain as a baseline
+        Tree loop(dimension, 0);
+        stop_watch voxels;
+        for ( int z = 0 ; z < dimension ; ++z ) {
+                for ( int y = 0 ; y < dimension ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) {
+                                const int va = a.get(x, y, z);
+                                loop.set(x, y, z, ( va != 0 ) ? va : b.get(x, y, z));
+                        }
+                }
+        }
+        const double loop_ns = voxels.ns();
+
+        const char* names[] = { "union", "intersection", "difference", "min", "max" };
+        std::cout<<"combine "<<dimension<<"^3	get()/set() loop (union) "<<loop_ns * 1e-6<<" ms";
+        for ( int op = 0 ; op < 5 ; ++op ) {
+                Tree c;
+                stop_watch combined;
+                c.combine(a, b, static_cast<Tree::combine_op>(op));
+                std::cout<<"	"<<names[op]<<" "<<combined.ns() * 1e-6<<" ms";
+        }
+        stop_watch in_place;
+        a.combine(a, mask, Tree::DIFFERENCE);
+        std::cout<<"	in-place mask difference "<<in_place.ns() * 1e-6<<" ms"<<std::endl;
+        return;
+}
+
+/**
+* @brief run a workload on an octree and report throughput, latency, shape and memory.
+* @param[in] name name of the workload
+* @param[in] dimension dimension of the octree
+* @param[in] xyz voxels set in this order (x0, y0, z0, x1, y1, z1, ...)
+* @param[in] values the number of distinct values (1 : uniform, optimize() merges)
+* @param[in] lookups the number of random get()
+*/
+void bench_workload ( const char* name, const int dimension, const std::vector<int>& xyz, const int values, const int lookups )
+{
+        const int batch = 64;
+        typedef mi::octree<int, mi::pool_allocator> Tree;
+        Tree tree(dimension, 0);
+        const int n = static_cast<int>( xyz.size() / 3 );
+        latency set, random_get, sweep;
+        for ( int i = 0 ; i < n ; i += batch ) {
+                const int m = std::min( batch, n - i );
+                stop_watch watch;
+                for ( int k = i ; k < i + m ; ++k ) tree.set(xyz[3*k], xyz[3*k+1], xyz[3*k+2], 1 + k % values);
+                set.add( watch.ns(), m );
+        }
+
+        random_number rnd(12345);
+        std::vector<int> query( 3 * batch );
+        long long sum = 0;
+        for ( int i = 0 ; i < lookups ; i += batch ) {
+                for ( size_t k = 0 ; k < query.size() ; ++k ) query[k] = rnd.next(dimension);
+                stop_watch watch;
+                for ( int k = 0 ; k < batch ; ++k ) sum += tree.get(query[3*k], query[3*k+1], query[3*k+2]);
+                random_get.add( watch.ns(), batch );
+        }
+        // coherent sweep in scan order over (at most) 2^21 voxels of the occupied region
+        int mnx, mny, mnz, mxx, mxy, mxz;
+        stop_watch bbox;
+        tree.boundingbox(mnx, mny, mnz, mxx, mxy, mxz);
+        const double bbox_ns = bbox.ns();
+        const int side = std::min( dimension - mnx, 128 );
+        for ( int z = mnz ; z < mnz + side && z < dimension ; ++z ) {
+                for ( int y = mny ; y < mny + side && y < dimension ; ++y ) {
+                        stop_watch watch;
+                        for ( int x = mnx ; x < mnx + side ; ++x ) sum += tree.get(x, y, z);
+                        sweep.add( watch.ns(), side );
+                }
+        }
+
+        const Tree::profile before = tree.get_profile();
+        stop_watch optimize;
+        tree.optimize();
+        const double optimize_ns = optimize.ns();
+        const Tree::profile shape = tree.get_profile();
+
+        stop_watch write;
+        std::ofstream fout("bench_suite.oct", std::ios::binary);
+        tree.write_compressed(fout);
+        const long long size = fout.tellp();
+        fout.close();
+        const double write_ns = write.ns();
+        stop_watch read;
+        Tree loaded;
+        std::ifstream fin("bench_suite.oct", std::ios::binary);
+        loaded.read(fin);
+        const double read_ns = read.ns();
+        std::remove("bench_suite.oct");
+
+        int depth = 0;
+        for ( int d = 0 ; d < 32 ; ++d ) if ( shape.depth[d] != 0 ) depth = d;
+        std::cout<<name<<" ("<<dimension<<"^3, "<<n<<" sets)";
+        set.print(std::cout, "set");
+        random_get.print(std::cout, "random get");
+        sweep.print(std::cout, "sweep get");
+        std::cout<<std::endl<<"\tboundingbox() "<<bbox_ns * 1e-6<<" ms\toptimize() "<<optimize_ns * 1e-6<<" ms ("<<before.nodes - shape.nodes<<" nodes merged)"
+                 <<"\twrite_compressed() "<<write_ns * 1e-6<<" ms ("<<size / 1024<<" KiB)\tread() "<<read_ns * 1e-6<<" ms"<<std::endl;
+        std::cout<<"\t"<<shape.nodes<<" nodes, "<<shape.leaves<<" leaves, depth";
+        for ( int d = 0 ; d <= depth ; ++d ) std::cout<<( d == 0 ? " " : "/" )<<shape.depth[d];
+        std::cout<<"\t"<<shape.bytes / 1024<<" KiB";
+#ifdef MI_OCTREE_PROFILE
+        std::cout<<"\t"<<shape.splits<<" splits, "<<shape.merges<<" merges";
+#endif
+        std::cout<<"\tpeak RSS "<<peak_rss() / 1024<<" MiB\t(checksum "<<sum<<")"<<std::endl;
+        return;
+}
+
+/**
+* @brief reproducible workloads: sparse random points, a dense sphere and a slab.
+*/
+void bench_workloads ( const int dimension, const int points, const int size, const int lookups )
+{
+        std::vector<int> xyz;
+        random_number rnd(12345);
+        for ( int i = 0 ; i < 3 * points ; ++i ) xyz.push_back( rnd.next(dimension) );
+        bench_workload("sparse random", dimension, xyz, 7, lookups);
+
+        xyz.clear();
+        const int c = size / 2, r = size / 3;
+        for ( int z = 0 ; z < size ; ++z ) {
+                for ( int y = 0 ; y < size ; ++y ) {
+                        for ( int x = 0 ; x < size ; ++x ) {
+                                if ( ( x - c ) * ( x - c ) + ( y - c ) * ( y - c ) + ( z - c ) * ( z - c ) >= r * r ) continue;
+                                xyz.push_back(x);
+                                xyz.push_back(y);
+                                xyz.push_back(z);
+                        }
+                }
+        }
+        bench_workload("dense sphere ", size, xyz, 1, lookups);
+
+        xyz.clear();
+        for ( int z = c ; z < c + 4 ; ++z ) {
+                for ( int y = 0 ; y < size ; ++y ) {
+                        for ( int x = 0 ; x < size ; ++x ) {
+                                xyz.push_back(x);
+                                xyz.push_back(y);
+                                xyz.push_back(z);
+                        }
+                }
+        }
+        bench_workload("slab         ", size, xyz, 1, lookups);
+        return;
+}
+
+template < typename Tree >
+void bench_linear_get ( const char* name, const Tree& tree, const std::vector<int>& xyz, const std::vector<int>& hits, const double build_ns, const size_t bytes )
+{
+        long long sum = 0;
+        const int lookups = static_cast<int>( xyz.size() / 3 );
+        stop_watch random_access;
+        for ( int i = 0 ; i < lookups ; ++i ) sum += tree.get(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+        const double random_ns = random_access.ns();
+        const int points = static_cast<int>( hits.size() / 3 );
+        stop_watch hit_access;
+        for ( int i = 0 ; i < points ; ++i ) sum += tree.get(hits[3*i], hits[3*i+1], hits[3*i+2]);
+        const double hit_ns = hit_access.ns();
+        const int side = static_cast<int>( std::cbrt( static_cast<double>(lookups) ) );
+        stop_watch coherent_access;
+        for ( int z = 0 ; z < side ; ++z ) {
+                for ( int y = 0 ; y < side ; ++y ) {
+                        for ( int x = 0 ; x < side ; ++x ) sum += tree.get(x, y, z);
+                }
+        }
+        const double coherent_ns = coherent_access.ns();
+        std::cout<<name<<"\tbuild "<<build_ns * 1e-6<<" ms"
+                 <<"\trandom get "<<random_ns / lookups<<" ns/lookup"
+                 <<"\thit get "<<hit_ns / points<<" ns/lookup"
+                 <<"\tcoherent get "<<coherent_ns / ( static_cast<double>(side) * side * side )<<" ns/lookup"
+                 <<"\t"<<bytes / 1024<<" KiB"
+                 <<"\t(checksum "<<sum<<")"<<std::endl;
+        return;
+}
+
+void bench_linear ( const int dimension, const int points, const int lookups )
+{
+        mi::octree<int, mi::pool_allocator> tree(dimension, 0);
+        random_number rnd(12345);
+        std::vector<int> hits( 3 * static_cast<size_t>(points) );
+        for ( size_t i = 0 ; i < hits.size() ; ++i ) hits[i] = rnd.next(dimension);
+        stop_watch fill;
+        for ( int i = 0 ; i < points ; ++i ) tree.set(hits[3*i], hits[3*i+1], hits[3*i+2], 1 + i % 7);
+        const double fill_ns = fill.ns();
+        std::vector<int> xyz( 3 * static_cast<size_t>(lookups) );
+        for ( size_t i = 0 ; i < xyz.size() ; ++i ) xyz[i] = rnd.next(dimension);
+
+        bench_linear_get("linear: octree        ", tree, xyz, hits, fill_ns, tree.bytes_used());
+        mi::linear_octree<int> linear;
+        stop_watch build;
+        linear.build(tree);
+        const double build_ns = build.ns();
+        bench_linear_get("linear: linear_octree ", linear, xyz, hits, build_ns, linear.bytes_used());
+        const char* names[] = { "linear: + 2-level LUT ", "linear: + 4-level LUT ", "linear: + 6-level LUT " };
+        for ( int i = 0 ; i < 3 ; ++i ) {
+                stop_watch index;
+                linear.build_index(2 * i + 2);
+                const double index_ns = index.ns();
+                bench_linear_get(names[i], linear, xyz, hits, build_ns + index_ns, linear.bytes_used());
+        }
+        return;
+}
+
+template < typename Tree >
+void bench_volume ( const char* name, const char* volume, const int dimension, const std::vector<int>& xyz )
+{
+        Tree tree(dimension, 0);
+        const size_t n = xyz.size() / 3;
+        stop_watch build;
+        for ( size_t i = 0 ; i < n ; ++i ) tree.set(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], 1 + static_cast<int>( i % 7 ));
+        const double build_ns = build.ns();
+
+        long long sum = 0;
+        stop_watch lookup;
+        for ( size_t i = 0 ; i < n ; ++i ) sum += tree.get(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+        const double lookup_ns = lookup.ns();
+
+        stop_watch scan;
+        const size_t nonempty = tree.count_nonempty();
+        const double scan_ns = scan.ns();
+        std::cout<<volume<<" "<<name<<"	set "<<build_ns / n<<" ns/op	get "<<lookup_ns / n<<" ns/op	count_nonempty "<<scan_ns * 1e-6<<" ms ("
+                 <<nonempty<<")	"<<tree.bytes_used() / 1024.0 / 1024.0<<" MiB	(sum "<<sum<<")"<<std::endl;
+        return;
+}
+
+void bench_bricks ( const int dimension )
+{
+        // dense surface : a spherical shell of thickness 3 in scan order.
+        std::vector<int> shell;
+        const double c = dimension / 2.0, r = dimension / 3.0;
+        for ( int z = 0 ; z < dimension ; ++z ) {
+                for ( int y = 0 ; y < dimension ; ++y ) {
+                        for ( int x = 0 ; x < dimension ; ++x ) {
+                                const double d = std::sqrt( ( x - c ) * ( x - c ) + ( y - c ) * ( y - c ) + ( z - c ) * ( z - c ) );
+                                if ( std::fabs( d - r ) > 1.5 ) continue;
+                                shell.push_back(x);
+                                shell.push_back(y);
+                                shell.push_back(z);
+                        }
+                }
+        }
+        bench_volume< mi::octree<int, mi::pool_allocator> >      ("octree      ", "dense shell ", dimension, shell);
+        bench_volume< mi::brick_octree<int, mi::pool_allocator> >("brick_octree", "dense shell ", dimension, shell);
+
+        std::vector<int> sparse;
+        random_number rnd(12345);
+        for ( size_t i = 0 ; i < shell.size() / 3 ; ++i ) {
+                sparse.push_back(rnd.next(dimension));
+                sparse.push_back(rnd.next(dimension));
+                sparse.push_back(rnd.next(dimension));
+        }
+        bench_volume< mi::octree<int, mi::pool_allocator> >      ("octree      ", "sparse random", dimension, sparse);
+        bench_volume< mi::brick_octree<int, mi::pool_allocator> >("brick_octree", "sparse random", dimension, sparse);
+        return;
+}
+
+/**
+* @brief march a ray voxel by voxel with get() (the way rays were cast before raycast()).
+*/
+template < typename Tree >
+bool march ( const Tree& tree, const double* o, const double* d, const double tmax )
+{
+        const double size = tree.getDimension();
+        double t0 = 0, t1 = tmax;
+        for ( int a = 0 ; a < 3 ; ++a ) {
+                if ( d[a] == 0 ) {
+                        if ( o[a] < 0 || size <= o[a] ) return false;
+                        continue;
+                }
+                double ta = -o[a] / d[a], tb = ( size - o[a] ) / d[a];
+                if ( tb < ta ) std::swap(ta, tb);
+                t0 = std::max(t0, ta);
+                t1 = std::min(t1, tb);
+        }
+        if ( t1 < t0 ) return false;
+        int v[3];
+        for ( int a = 0 ; a < 3 ; ++a ) v[a] = std::max( 0, std::min( tree.getDimension() - 1, static_cast<int>( std::floor( o[a] + d[a] * t0 ) ) ) );
+        for ( ; ; ) {
+                if ( tree.get(v[0], v[1], v[2]) != tree.getEmptyValue() ) return true;
+                int axis = -1;
+                double exit = t1;
+                for ( int a = 0 ; a < 3 ; ++a ) {
+                        if ( d[a] == 0 ) continue;
+                        const double ta = ( ( d[a] > 0 ? v[a] + 1 : v[a] ) - o[a] ) / d[a];
+                        if ( ta <= exit ) {
+                                exit = ta;
+                                axis = a;
+                        }
+                }
+                if ( axis < 0 ) return false;
+                v[axis] += ( d[axis] > 0 ) ? 1 : -1;
+                if ( v[axis] < 0 || tree.getDimension() <= v[axis] ) return false;
+        }
+}
+
+template < typename Tree >
+void bench_rays ( const char* scene, const Tree& tree, const int rays )
+{
+        const int dimension = tree.getDimension();
+        std::vector<double> origins, directions;
+        random_number rnd(12345);
+        for ( int i = 0 ; i < rays ; ++i ) {
+                // from a random point on the boundary of the domain to a random point inside.
+                double o[3], p[3];
+                for ( int a = 0 ; a < 3 ; ++a ) {
+                        o[a] = rnd.next(dimension * 16) / 16.0;
+                        p[a] = rnd.next(dimension * 16) / 16.0;
+                }
+                o[i % 3] = ( i % 2 ) ? -1.0 : dimension + 1.0;
+                for ( int a = 0 ; a < 3 ; ++a ) {
+                        origins.push_back(o[a]);
+                        directions.push_back(p[a] - o[a]);
+                }
+        }
+        std::vector<typename Tree::ray_hit> hits(rays);
+        size_t found = 0;
+        stop_watch single;
+        for ( int i = 0 ; i < rays ; ++i ) {
+                if ( tree.raycast(origins[3 * i], origins[3 * i + 1], origins[3 * i + 2], directions[3 * i], directions[3 * i + 1], directions[3 * i + 2], 2.0, hits[i]) ) ++found;
+        }
+        const double single_ns = single.ns();
+
+        stop_watch batch;
+        const size_t batch_found = tree.raycast_batch(&origins[0], &directions[0], rays, 2.0, &hits[0]);
+        const double batch_ns = batch.ns();
+
+        size_t marched = 0;
+        stop_watch naive;
+        for ( int i = 0 ; i < rays ; ++i ) {
+                if ( march(tree, &origins[3 * i], &directions[3 * i], 2.0) ) ++marched;
+        }
+        const double naive_ns = naive.ns();
+        std::cout<<"raycast "<<scene<<"	"<<found<<"/"<<rays<<" hits	raycast "<<rays / ( single_ns * 1e-9 ) * 1e-6<<" Mrays/s"
+                 <<"	raycast_batch "<<rays / ( batch_ns * 1e-9 ) * 1e-6<<" Mrays/s ("<<batch_found<<")"
+                 <<"	get() march "<<rays / ( naive_ns * 1e-9 ) * 1e-6<<" Mrays/s ("<<marched<<")"<<std::endl;
+        return;
+}
+
+void bench_raycast ( const int dimension, const int rays )
+{
+        // a solid ball in the middle of the domain.
+        mi::octree<int, mi::pool_allocator> ball(dimension, 0);
+        const int c = dimension / 2, r = dimension / 4;
+        for ( int z = c - r ; z <= c + r ; ++z ) {
+                for ( int y = c - r ; y <= c + r ; ++y ) {
+                        const int w2 = r * r - ( y - c ) * ( y - c ) - ( z - c ) * ( z - c );
+                        if ( w2 < 0 ) continue;
+                        const int w = static_cast<int>( std::sqrt( static_cast<double>(w2) ) );
+                        ball.fill_box(c - w, y, z, c + w, y, z, 1);
+                }
+        }
+        bench_rays("ball        ", ball, rays);
+
+        // small random boxes scattered in the domain.
+        mi::octree<int, mi::pool_allocator, mi::subtree_statistics> boxes(dimension, 0);
+        random_number rnd(54321);
+        for ( int i = 0 ; i < 200 ; ++i ) {
+                const int x = rnd.next(dimension), y = rnd.next(dimension), z = rnd.next(dimension), s = 1 + rnd.next(8);
+                boxes.fill_box(x, y, z, x + s, y + s, z + s, 1 + i % 7);
+        }
+        bench_rays("random boxes", boxes, rays);
+        return;
+}
+
+void bench_nearest ( const int dimension, const int points )
+{
+        mi::octree<int, mi::pool_allocator, mi::subtree_statistics> tree(dimension, 0);
+        random_number rnd(12345);
+        for ( int i = 0 ; i < points ; ++i ) tree.set(rnd.next(dimension), rnd.next(dimension), rnd.next(dimension), 1 + i % 7);
+
+        const int queries = 200;
+        std::vector<int> q;
+        for ( int i = 0 ; i < 3 * queries ; ++i ) q.push_back(rnd.next(dimension));
+
+        long long hierarchy = 0;
+        stop_watch best_first;
+        for ( int i = 0 ; i < queries ; ++i ) {
+                mi::octree<int, mi::pool_allocator, mi::subtree_statistics>::voxel v;
+                if ( tree.nearest(q[3 * i], q[3 * i + 1], q[3 * i + 2], v) ) {
+                        hierarchy += ( v.x - q[3 * i] ) * ( v.x - q[3 * i] ) + ( v.y - q[3 * i + 1] ) * ( v.y - q[3 * i + 1] ) + ( v.z - q[3 * i + 2] ) * ( v.z - q[3 * i + 2] );
+                }
+        }
+        const double best_first_ns = best_first.ns();
+
+        // brute force : grow a cube of get() calls until it contains the closest voxel.
+        long long scanned = 0;
+        stop_watch brute;
+        for ( int i = 0 ; i < queries ; ++i ) {
+                const int x = q[3 * i], y = q[3 * i + 1], z = q[3 * i + 2];
+                long long best = -1;
+                for ( int k = 0 ; k < dimension && ( best < 0 || static_cast<long long>(k - 1) * ( k - 1 ) < best ) ; ++k ) {
+                        for ( int c = z - k ; c <= z + k ; ++c ) {
+                                for ( int b = y - k ; b <= y + k ; ++b ) {
+                                        const bool face = ( c == z - k || c == z + k || b == y - k || b == y + k );
+                                        for ( int a = x - k ; a <= x + k ; a += ( face ? 1 : 2 * k ) ) {
+                                                if ( tree.get(a, b, c) == 0 ) {
+                                                        if ( k == 0 ) break;
+                                                        continue;
+                                                }
+                                                const long long d = static_cast<long long>(a - x) * ( a - x ) + static_cast<long long>(b - y) * ( b - y ) + static_cast<long long>(c - z) * ( c - z );
+                                                if ( best < 0 || d < best ) best = d;
+                                                if ( k == 0 ) break;
+                                        }
+                                }
+                        }
+                }
+                scanned += best;
+        }
+        const double brute_ns = brute.ns();
+
+        const double r = 16.0;
+        size_t found = 0;
+        std::vector< mi::octree<int, mi::pool_allocator, mi::subtree_statistics>::voxel > out;
+        stop_watch radius;
+        for ( int i = 0 ; i < queries ; ++i ) {
+                out.clear();
+                found += tree.radius_query(q[3 * i], q[3 * i + 1], q[3 * i + 2], r, out);
+        }
+        const double radius_ns = radius.ns();
+
+        size_t cube_found = 0;
+        stop_watch cube;
+        for ( int i = 0 ; i < queries ; ++i ) {
+                const int x = q[3 * i], y = q[3 * i + 1], z = q[3 * i + 2];
+                for ( int c = z - 16 ; c <= z + 16 ; ++c ) {
+                        for ( int b = y - 16 ; b <= y + 16 ; ++b ) {
+                                for ( int a = x - 16 ; a <= x + 16 ; ++a ) {
+                                        if ( ( a - x ) * ( a - x ) + ( b - y ) * ( b - y ) + ( c - z ) * ( c - z ) <= r * r && tree.get(a, b, c) != 0 ) ++cube_found;
+                                }
+                        }
+                }
+        }
+        const double cube_ns = cube.ns();
+        std::cout<<"nearest "<<points<<" points	best-first "<<best_first_ns / queries * 1e-3<<" us/query	cube scan "<<brute_ns / queries * 1e-3
+                 <<" us/query	(sums "<<hierarchy<<", "<<scanned<<")"<<std::endl;
+        std::cout<<"radius_query r="<<r<<"	hierarchy "<<radius_ns / queries * 1e-3<<" us/query	cube scan "<<cube_ns / queries * 1e-3
+                 <<" us/query	("<<found<<", "<<cube_found<<" voxels)"<<std::endl;
+        return;
+}
+
+template < typename Tree >
+void bench_slab_tree ( const char* name, Tree& tree, const int nx, const int ny, const std::vector<int>& height, const unsigned char depth )
+{
+        stop_watch build;
+        for ( int y = 0 ; y < ny ; ++y ) {
+                for ( int x = 0 ; x < nx ; ++x ) tree.set(x, y, height[x + nx * y], 1);
+        }
+        const double build_ns = build.ns();
+
+        random_number rnd(12345);
+        long long sum = 0;
+        const int lookups = 1000000;
+        stop_watch lookup;
+        for ( int i = 0 ; i < lookups ; ++i ) {
+                const int x = rnd.next(nx), y = rnd.next(ny);
+                sum += tree.get(x, y, height[x + nx * y]);
+        }
+        const double lookup_ns = lookup.ns();
+        std::cout<<"slab "<<name<<"	depth "<<static_cast<int>(depth)<<"	set "<<build_ns / ( static_cast<double>(nx) * ny )<<" ns/op	get "<<lookup_ns / lookups
+                 <<" ns/op	"<<tree.bytes_used() / 1024.0 / 1024.0<<" MiB	(sum "<<sum<<")"<<std::endl;
+        return;
+}
+
+void bench_slab ( const int nx, const int ny, const int nz )
+{
+        // a height field (one surface voxel per column) like a laser scan of terrain.
+        std::vector<int> height( static_cast<size_t>(nx) * ny );
+        for ( int y = 0 ; y < ny ; ++y ) {
+                for ( int x = 0 ; x < nx ; ++x ) {
+                        const double h = 0.5 + 0.25 * std::sin( x * 0.01 ) + 0.2 * std::cos( y * 0.013 );
+                        height[x + nx * y] = std::max( 0, std::min( nz - 1, static_cast<int>( h * nz ) ) );
+                }
+        }
+        mi::octree<int> cube( std::max( nx, std::max( ny, nz ) ), 0 );
+        int level = 0;
+        while ( ( 1 << level ) < cube.getDimension() ) ++level;
+        bench_slab_tree("octree      ", cube, nx, ny, height, static_cast<unsigned char>(level));
+        mi::octree_grid<int> grid(nx, ny, nz, 0);
+        bench_slab_tree("octree_grid ", grid, nx, ny, height, grid.depth());
+        return;
+}
+
+template < typename Tree >
+void bench_thin_slab_tree ( const char* name, Tree& tree, const int nx, const int ny, const int nz, const unsigned char depth )
+{
+        stop_watch build;
+        for ( int z = 0 ; z < nz ; ++z ) {
+                for ( int y = 0 ; y < ny ; ++y ) {
+                        for ( int x = 0 ; x < nx ; ++x ) tree.set(x, y, z, 1 + ( x + y + z ) % 5);
+                }
+        }
+        const double build_ns = build.ns();
+
+        random_number rnd(12345);
+        long long sum = 0;
+        const int lookups = 1000000;
+        stop_watch lookup;
+        for ( int i = 0 ; i < lookups ; ++i ) sum += tree.get(rnd.next(nx), rnd.next(ny), rnd.next(nz));
+        const double lookup_ns = lookup.ns();
+        std::cout<<"thin slab "<<nx<<"x"<<ny<<"x"<<nz<<" "<<name<<"	depth "<<static_cast<int>(depth)<<"	set "<<build_ns / ( static_cast<double>(nx) * ny * nz )
+                 <<" ns/op	get "<<lookup_ns / lookups<<" ns/op	"<<tree.bytes_used() / 1024.0 / 1024.0<<" MiB	(sum "<<sum<<")"<<std::endl;
+        return;
+}
+
+void bench_thin_slab ( const int nx, const int ny )
+{
+        // a dense image stack of 1 to 4 slices.
+        for ( int nz = 1 ; nz <= 4 ; ++nz ) {
+                {
+                        mi::octree<int> cube( std::max( nx, ny ), 0 );
+                        int level = 0;
+                        while ( ( 1 << level ) < cube.getDimension() ) ++level;
+                        bench_thin_slab_tree("octree     ", cube, nx, ny, nz, static_cast<unsigned char>(level));
+                }
+                mi::octree_grid<int> grid(nx, ny, nz, 0);
+                bench_thin_slab_tree("octree_grid", grid, nx, ny, nz, grid.depth());
+        }
+        return;
+}
+
+int main ( int argc, char** argv )
+{
+        const int dimension = ( argc > 1 ) ? std::atoi(argv[1]) : 1024;
+        const int points    = ( argc > 2 ) ? std::atoi(argv[2]) : 200000;
+        const int lookups   = ( argc > 3 ) ? std::atoi(argv[3]) : 2000000;
+        std::cout<<"dimension "<<dimension<<", "<<points<<" points, "<<lookups<<" lookups"<<std::endl;
+        bench_workloads(dimension, points, ( argc > 4 ) ? std::atoi(argv[4]) : 256, lookups);
+        bench_lookup<mi::new_allocator>    ("new_allocator    ", dimension, points, lookups);
+        bench_lookup<mi::pool_allocator>   ("pool_allocator   ", dimension, points, lookups);
+        bench_lookup<mi::compact_allocator>("compact_allocator", dimension, points, lookups);
+        bench_batch<mi::pool_allocator>    ("pool_allocator   ", dimension, points, lookups);
+        bench_batch<mi::compact_allocator> ("compact_allocator", dimension, points, lookups);
+        bench_dense( ( argc > 4 ) ? std::atoi(argv[4]) : 256 );
+        bench_bricks( ( argc > 4 ) ? std::atoi(argv[4]) : 256 );
+        bench_raycast( ( argc > 4 ) ? std::atoi(argv[4]) : 256, 100000 );
+        bench_load(dimension, points);
+        bench_fill(dimension);
+        bench_leaves(dimension, points);
+        bench_nearest(dimension, points);
+        bench_slab(2048, 2048, 64);
+        bench_thin_slab(1024, 1024);
+        bench_accessor(dimension);
+        bench_snapshot(dimension, points);
+        bench_delta(dimension, points);
+        bench_reset(dimension, points);
+        bench_lod(dimension, points);
+        bench_linear(dimension, points, lookups);
+        bench_combine( ( argc > 4 ) ? std::atoi(argv[4]) : 256, points / 10 );
+        bench_concurrent(dimension, points);
+        return EXIT_SUCCESS;
+}
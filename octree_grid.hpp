@@ -0,0 +1,384 @@
+/*
+
+Copyright (c) 2009, Takashi Michikawa
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of RCAST, The University of Tokyo nor the names of its
+contributors may be used to endorse or promote products derived from
+this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/**
+* @file octree_grid.hpp
+* @brief
+* "octree_grid" covers an anisotropic nx x ny x nz domain with a grid of
+* cubic root octrees, so a thin slab is not stored as a cube of its
+* largest extent.
+*
+* @note This code is distributed under BSD license.
+*/
+#ifndef __OCTREE_GRID_HPP__
+#define __OCTREE_GRID_HPP__ 1
+#include "octree.hpp"
+#include <cmath>
+
+namespace mi
+{
+        /**
+        * @class octree_grid
+        * octree_grid is a grid of octrees with the same empty value.
+        * @section ex Example code
+        * @code
+        * mi::octree_grid<int> grid(2048, 2048, 64, 0); // 32 x 32 x 1 roots of 64^3
+        * grid.set(1000, 2000, 30, 4);
+        * int value = grid.get(1000, 2000, 30); // value = 4;
+        * bool valid = grid.is_valid(0, 0, 64); // valid = false;
+        * @endcode
+        * @note A root is allocated when a non-empty value is first written to it.
+        * Allocators reserving memory in chunks (pool_allocator, compact_allocator)
+        * keep one chunk per allocated root.
+        */
+        template < typename T, template < typename > class Allocator = new_allocator, typename Statistics = no_statistics >
+        class octree_grid
+        {
+        public:
+                typedef octree<T, Allocator, Statistics> tree_type; ///< Type of root octrees.
+        private:
+                int                     _extent[3];      ///< Size of the domain along each axis.
+                int                     _grid[3];        ///< The number of roots along each axis.
+                unsigned char           _level;          ///< Level of root octrees.
+                T                       _emptyValue;     ///< Empty value of the grid.
+                std::vector<tree_type*> _roots;          ///< Root octrees (NULL : not allocated, all empty).
+        private:
+                octree_grid ( const octree_grid& that );
+                void operator = ( const octree_grid& that );
+        public:
+                /**
+                * @brief Default constructor.
+                */
+                octree_grid ( void ) : _level(0), _emptyValue() {
+                        this->_extent[0] = this->_extent[1] = this->_extent[2] = 0;
+                        this->_grid[0] = this->_grid[1] = this->_grid[2] = 0;
+                        return;
+                }
+
+                /**
+                * @param[in] nx size of the domain along x-axis
+                * @param[in] ny size of the domain along y-axis
+                * @param[in] nz size of the domain along z-axis
+                * @param[in] emptyValue the default value of the grid
+                * @param[in] rootDimension dimension of root octrees (0 : the smallest extent rounded up to 2^n, raised until there are at most d^3 / 8 roots)
+                */
+                octree_grid ( const int nx, const int ny, const int nz, const T emptyValue = T(), const int rootDimension = 0 ) : _level(0), _emptyValue(emptyValue) {
+                        this->init( nx, ny, nz, emptyValue, rootDimension );
+                        return;
+                }
+
+                /**
+                * @brief Destructor
+                */
+                ~octree_grid ( void ) {
+                        this->release();
+                        return;
+                }
+
+                /**
+                * @param[in] nx size of the domain along x-axis
+                * @param[in] ny size of the domain along y-axis
+                * @param[in] nz size of the domain along z-axis
+                * @param[in] emptyValue the default value of the grid
+                * @param[in] rootDimension dimension of root octrees (0 : the smallest extent rounded up to 2^n, raised until there are at most d^3 / 8 roots)
+                */
+                void init ( const int nx, const int ny, const int nz, const T emptyValue, const int rootDimension = 0 ) {
+                        this->release();
+                        this->_extent[0] = std::max( nx, 1 );
+                        this->_extent[1] = std::max( ny, 1 );
+                        this->_extent[2] = std::max( nz, 1 );
+                        const int d = ( rootDimension > 0 ) ? rootDimension : std::min( this->_extent[0], std::min( this->_extent[1], this->_extent[2] ) );
+                        this->_level = 0;
+                        while ( this->_level < tree_type::MAX_LEVEL && ( 1 << this->_level ) < d ) ++this->_level;
+                        // each root costs an octree object and its allocator, so thin domains get larger roots (at most d^3 / 8 of them).
+                        while ( rootDimension <= 0 && this->_level < tree_type::MAX_LEVEL &&
+                                this->grid_size( this->_level ) * 8.0 > std::pow( 8.0, this->_level ) ) ++this->_level;
+                        for ( int a = 0 ; a < 3 ; ++a ) this->_grid[a] = ( ( this->_extent[a] - 1 ) >> this->_level ) + 1;
+                        this->_emptyValue = emptyValue;
+                        this->_roots.assign( static_cast<size_t>( this->_grid[0] ) * this->_grid[1] * this->_grid[2], NULL );
+                        return;
+                }
+
+                /**
+                * @brief get value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                */
+                T get ( const int x, const int y, const int z ) const {
+                        if ( !this->is_valid(x, y, z) ) return this->_emptyValue;
+                        const tree_type* tree = this->_roots[ this->root_index( x, y, z ) ];
+                        if ( tree == NULL ) return this->_emptyValue;
+                        const int m = ( 1 << this->_level ) - 1;
+                        return tree->get( x & m, y & m, z & m );
+                }
+
+                /**
+                * @brief set value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @param[in] v value
+                * @note do nothing if (x,y,z) is invalid.
+                */
+                void set ( const int x, const int y, const int z, const T v ) {
+                        if ( !this->is_valid(x, y, z) ) return;
+                        tree_type* tree = this->root( this->root_index( x, y, z ), v != this->_emptyValue );
+                        if ( tree == NULL ) return;
+                        const int m = ( 1 << this->_level ) - 1;
+                        tree->set( x & m, y & m, z & m, v );
+                        return;
+                }
+
+                /**
+                * @brief set value to all voxels in the box (mnx, mny, mnz) - (mxx, mxy, mxz)
+                * @param[in] mnx minimum x-coordinate
+                * @param[in] mny minimum y-coordinate
+                * @param[in] mnz minimum z-coordinate
+                * @param[in] mxx maximum x-coordinate
+                * @param[in] mxy maximum y-coordinate
+                * @param[in] mxz maximum z-coordinate
+                * @param[in] v value
+                * @note The box is clipped by the domain.
+                */
+                void fill_box ( const int mnx, const int mny, const int mnz, const int mxx, const int mxy, const int mxz, const T v ) {
+                        const int mn[3] = { std::max( mnx, 0 ), std::max( mny, 0 ), std::max( mnz, 0 ) };
+                        const int mx[3] = { std::min( mxx, this->_extent[0] - 1 ), std::min( mxy, this->_extent[1] - 1 ), std::min( mxz, this->_extent[2] - 1 ) };
+                        if ( mx[0] < mn[0] || mx[1] < mn[1] || mx[2] < mn[2] ) return;
+                        const int d = 1 << this->_level;
+                        for ( int gz = mn[2] >> this->_level ; gz <= mx[2] >> this->_level ; ++gz ) {
+                                for ( int gy = mn[1] >> this->_level ; gy <= mx[1] >> this->_level ; ++gy ) {
+                                        for ( int gx = mn[0] >> this->_level ; gx <= mx[0] >> this->_level ; ++gx ) {
+                                                tree_type* tree = this->root( gx + this->_grid[0] * ( gy + this->_grid[1] * gz ), v != this->_emptyValue );
+                                                if ( tree == NULL ) continue;
+                                                tree->fill_box( mn[0] - gx * d, mn[1] - gy * d, mn[2] - gz * d, mx[0] - gx * d, mx[1] - gy * d, mx[2] - gz * d, v );
+                                        }
+                                }
+                        }
+                        return;
+                }
+
+                /**
+                * @brief check (x, y, z) is valid
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is in the domain
+                * @retval false (x, y, z) is invalid
+                */
+                bool is_valid ( const int x, const int y, const int z ) const {
+                        if ( x < 0 || y < 0 || z < 0 ) return false;
+                        if ( this->_extent[0] <= x || this->_extent[1] <= y || this->_extent[2] <= z ) return false;
+                        return true;
+                }
+
+                /**
+                * @brief check (x, y, z) is empty
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is empty
+                * @retval false (x, y, z) is not empty
+                */
+                bool is_empty ( const int x, const int y, const int z ) const {
+                        return this->get(x, y, z) == this->_emptyValue;
+                }
+
+                /**
+                * @brief get bounding box (mnx, mny, mnz) - (mxx, mxy, mxz)
+                * @param[out] mnx minimum x-coordinate
+                * @param[out] mny minimum y-coordinate
+                * @param[out] mnz minimum z-coordinate
+                * @param[out] mxx maximum x-coordinate
+                * @param[out] mxy maximum y-coordinate
+                * @param[out] mxz maximum z-coordinate
+                * @param[in] optimized if true, get bounding box of non-empty cells, otherwise the domain.
+                * @note If the grid is empty, the box is inverted (mnx > mxx).
+                */
+                void boundingbox ( int& mnx, int& mny, int& mnz, int& mxx, int& mxy, int& mxz, bool optimized = true ) const {
+                        if ( !optimized ) {
+                                mnx = mny = mnz = 0;
+                                mxx = this->_extent[0] - 1;
+                                mxy = this->_extent[1] - 1;
+                                mxz = this->_extent[2] - 1;
+                                return;
+                        }
+                        mnx = this->_extent[0] - 1;
+                        mny = this->_extent[1] - 1;
+                        mnz = this->_extent[2] - 1;
+                        mxx = mxy = mxz = 0;
+                        const int d = 1 << this->_level;
+                        for ( size_t i = 0 ; i < this->_roots.size() ; ++i ) {
+                                if ( this->_roots[i] == NULL ) continue;
+                                int lnx, lny, lnz, lxx, lxy, lxz;
+                                this->_roots[i]->boundingbox( lnx, lny, lnz, lxx, lxy, lxz, true );
+                                if ( lxx < lnx || lxy < lny || lxz < lnz ) continue;
+                                const int ox = d * static_cast<int>( i % this->_grid[0] );
+                                const int oy = d * static_cast<int>( ( i / this->_grid[0] ) % this->_grid[1] );
+                                const int oz = d * static_cast<int>( i / this->_grid[0] / this->_grid[1] );
+                                mnx = std::min( mnx, lnx + ox );
+                                mny = std::min( mny, lny + oy );
+                                mnz = std::min( mnz, lnz + oz );
+                                mxx = std::max( mxx, lxx + ox );
+                                mxy = std::max( mxy, lxy + oy );
+                                mxz = std::max( mxz, lxz + oz );
+                        }
+                        return;
+                }
+
+                /**
+                * @param[in] value The value which you count.
+                * @return the number of voxels in the domain with the value.
+                */
+                size_t count ( const T value ) const {
+                        if ( value == this->_emptyValue ) {
+                                return static_cast<size_t>( this->_extent[0] ) * this->_extent[1] * this->_extent[2] - this->count_nonempty();
+                        }
+                        size_t count = 0;
+                        for ( size_t i = 0 ; i < this->_roots.size() ; ++i ) {
+                                if ( this->_roots[i] != NULL ) count += this->_roots[i]->count( value );
+                        }
+                        return count;
+                }
+
+                /**
+                * @return the number of voxels which are not empty.
+                */
+                size_t count_nonempty ( void ) const {
+                        size_t count = 0;
+                        for ( size_t i = 0 ; i < this->_roots.size() ; ++i ) {
+                                if ( this->_roots[i] != NULL ) count += this->_roots[i]->count_nonempty();
+                        }
+                        return count;
+                }
+
+                /**
+                * @brief optimize all roots and release the roots which became empty.
+                * @param[in] threads the number of threads for each root (0 : hardware concurrency)
+                * @return the number of freed nodes.
+                */
+                size_t optimize ( const unsigned int threads = 0 ) {
+                        size_t count = 0;
+                        for ( size_t i = 0 ; i < this->_roots.size() ; ++i ) {
+                                if ( this->_roots[i] == NULL ) continue;
+                                count += this->_roots[i]->optimize( true, threads );
+                                if ( this->_roots[i]->count_nonempty() == 0 ) {
+                                        delete this->_roots[i];
+                                        this->_roots[i] = NULL;
+                                }
+                        }
+                        return count;
+                }
+
+                /**
+                * @param[out] nx size of the domain along x-axis
+                * @param[out] ny size of the domain along y-axis
+                * @param[out] nz size of the domain along z-axis
+                */
+                void getExtent ( int& nx, int& ny, int& nz ) const {
+                        nx = this->_extent[0];
+                        ny = this->_extent[1];
+                        nz = this->_extent[2];
+                        return;
+                }
+
+                /**
+                * @return dimension of root octrees. It is a 2^n.
+                */
+                int getRootDimension ( void ) const {
+                        return 1 << this->_level;
+                }
+
+                /**
+                * @return the maximum number of levels descended by get().
+                */
+                unsigned char depth ( void ) const {
+                        return this->_level;
+                }
+
+                /**
+                * @return empty value of the grid.
+                */
+                T getEmptyValue ( void ) const {
+                        return this->_emptyValue;
+                }
+
+                /**
+                * @return the number of allocated roots.
+                */
+                size_t roots ( void ) const {
+                        size_t count = 0;
+                        for ( size_t i = 0 ; i < this->_roots.size() ; ++i ) {
+                                if ( this->_roots[i] != NULL ) ++count;
+                        }
+                        return count;
+                }
+
+                /**
+                * @return bytes used by the grid and all roots.
+                */
+                size_t bytes_used ( void ) const {
+                        size_t bytes = sizeof(*this) + this->_roots.capacity() * sizeof(tree_type*);
+                        for ( size_t i = 0 ; i < this->_roots.size() ; ++i ) {
+                                if ( this->_roots[i] != NULL ) bytes += this->_roots[i]->bytes_used();
+                        }
+                        return bytes;
+                }
+        private:
+                /**
+                * @return the number of roots of dimension 2^level covering the domain.
+                */
+                double grid_size ( const unsigned char level ) const {
+                        double size = 1.0;
+                        for ( int a = 0 ; a < 3 ; ++a ) size *= static_cast<double>( ( ( this->_extent[a] - 1 ) >> level ) + 1 );
+                        return size;
+                }
+
+                size_t root_index ( const int x, const int y, const int z ) const {
+                        return static_cast<size_t>( x >> this->_level ) + this->_grid[0] * ( static_cast<size_t>( y >> this->_level ) + static_cast<size_t>( this->_grid[1] ) * ( z >> this->_level ) );
+                }
+
+                /**
+                * @return the root at index i. It is allocated only if create is true.
+                */
+                tree_type* root ( const size_t i, const bool create ) {
+                        if ( this->_roots[i] == NULL && create ) this->_roots[i] = new tree_type( 1 << this->_level, this->_emptyValue );
+                        return this->_roots[i];
+                }
+
+                void release ( void ) {
+                        for ( size_t i = 0 ; i < this->_roots.size() ; ++i ) delete this->_roots[i];
+                        this->_roots.clear();
+                        return;
+                }
+        };
+};
+#endif// __OCTREE_GRID_HPP__
@@ -29,7 +29,18 @@ POSSIBILITY OF SUCH DAMAGE.
 
 */
 #include "octree.hpp"
+#include "octree_view.hpp"
+#include "concurrent_octree.hpp"
+#include "brick_octree.hpp"
+#include "octree_grid.hpp"
+#include "linear_octree.hpp"
 #include <iostream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <sstream>
+#include <cstdio>
 // compile : g++ octree_main.cpp
 int main(int argc, char** argv)
 {
@@ -85,6 +96,379 @@ int main(int argc, char** argv)
                 std::cerr<<"invalid bounding box = ("<<mnx<<", "<<mny<<", "<<mnz<<")-("<<mxx<<", "<<mxy<<", "<<mxz<<")"<<std::endl;
                 return EXIT_FAILURE;
         }
+        //test mi::pool_allocator
+        mi::octree<int, mi::pool_allocator> tree4(1024, 0);
+        tree4.set(1,3,4, 10);
+        tree4.set(100,200,300, 3);
+        if ( tree4.get(1,3,4) != 10 || tree4.get(100,200,300) != 3 || tree4.get(1,0,4) != 0 ) {
+                std::cerr<<"Error at mi::octree<int, mi::pool_allocator>::get() "<<tree4.get(1,3,4)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        if ( tree4.get_allocator().live_blocks() != 18 || tree4.get_allocator().chunks() != 1 ) {
+                std::cerr<<"Error at mi::pool_allocator live blocks = "<<tree4.get_allocator().live_blocks()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        tree4.init(1024, 0);
+        if ( tree4.get_allocator().live_blocks() != 0 || tree4.get_allocator().chunks() != 0 ) {
+                std::cerr<<"Error at mi::pool_allocator::clear()"<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test mi::compact_allocator
+        mi::octree<int, mi::compact_allocator> tree5(1024, 0);
+        tree5.set(1,3,4, 10);
+        tree5.set(100,200,300, 3);
+        tree4.set(1,3,4, 10);
+        tree4.set(100,200,300, 3);
+        if ( tree5.get(1,3,4) != 10 || tree5.get(100,200,300) != 3 || tree5.get(1,0,4) != 0 ) {
+                std::cerr<<"Error at mi::octree<int, mi::compact_allocator>::get() "<<tree5.get(1,3,4)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        if ( tree5.bytes_used() >= tree4.bytes_used() ) {
+                std::cerr<<"Error at mi::octree<int, mi::compact_allocator>::bytes_used() "<<tree5.bytes_used()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::get_batch()/set_batch();
+        const int points[] = { 100, 200, 300,  1, 3, 4,  5, 6, 7,  -1, 0, 0,  5, 6, 7 };
+        const int values[] = { 1, 2, 3, 4, 5 };
+        int results[5];
+        tree5.set_batch(points, 5, values);
+        tree5.get_batch(points, 5, results);
+        if ( results[0] != 1 || results[1] != 2 || results[2] != 5 || results[3] != 0 || results[4] != 5 ) {
+                std::cerr<<"Error at mi::octree<int>::get_batch() "<<results[2]<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::build_from_dense();
+        std::vector<int> dense( 5 * 6 * 7, 1 );
+        dense[ 4 + 5 * ( 2 + 6 * 3 ) ] = 7;
+        mi::octree<int> tree6( &dense[0], 5, 6, 7, 0, 2 );
+        if ( tree6.getDimension() != 8 || tree6.get(4,2,3) != 7 || tree6.get(0,0,0) != 1 || tree6.get(5,0,0) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::build_from_dense() "<<tree6.get(4,2,3)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::optimize();
+        mi::octree<int> tree7(8, 0);
+        tree7.set(1,1,1, 5);
+        tree7.set(1,1,1, 0);
+        tree7.set(6,6,6, 3);
+        const size_t freed = tree7.optimize();
+        if ( freed != 16 || tree7.get(6,6,6) != 3 || tree7.get(1,1,1) != 0 || tree7.get(7,6,6) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::optimize() "<<freed<<std::endl;
+                return EXIT_FAILURE;
+        }
+        tree7.set(6,6,6, 0);
+        if ( tree7.optimize(true, 4) != 24 || tree7.get_allocator().live_blocks() != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::optimize()"<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::count() with mi::subtree_statistics
+        mi::octree<int, mi::pool_allocator, mi::subtree_statistics> tree8(1024, 0);
+        tree8.set(1,3,4, 10);
+        tree8.set(100,200,300, 3);
+        tree8.set(100,200,301, 3);
+        tree8.set(100,200,301, 0);
+        if ( tree8.count(3) != 1 || tree8.count(10) != 1 || tree8.count_nonempty() != 2 || tree8.count(0) != 1024 * 1024 * 1024 - 2 ) {
+                std::cerr<<"Error at mi::octree<int>::count() "<<tree8.count(3)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        if ( tree3.count(3) != 1 || tree3.count_nonempty() != 2 ) {
+                std::cerr<<"Error at mi::octree<int>::count() "<<tree3.count(3)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        tree8.boundingbox(mnx,mny,mnz,mxx,mxy,mxz, true);
+        if (!( mnx == 1 && mny == 3 && mnz == 4 && mxx == 100 && mxy == 200 && mxz == 300)) {
+                std::cerr<<"invalid bounding box = ("<<mnx<<", "<<mny<<", "<<mnz<<")-("<<mxx<<", "<<mxy<<", "<<mxz<<")"<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::write_flat() and mi::octree_view
+        std::ofstream flat("out_flat.oct", std::ios::binary);
+        tree3.write_flat(flat);
+        flat.close();
+        mi::octree_view<int> view("out_flat.oct");
+        if ( !view.is_open() || view.get(1,3,4) != 10 || view.get(100,200,300) != 3 || view.get(1,0,4) != 0 ) {
+                std::cerr<<"Error at mi::octree_view<int>::get() "<<view.get(1,3,4)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        view.boundingbox(mnx,mny,mnz,mxx,mxy,mxz, true);
+        if (!( mnx == 1 && mny == 3 && mnz == 4 && mxx == 100 && mxy == 200 && mxz == 300)) {
+                std::cerr<<"invalid bounding box = ("<<mnx<<", "<<mny<<", "<<mnz<<")-("<<mxx<<", "<<mxy<<", "<<mxz<<")"<<std::endl;
+                return EXIT_FAILURE;
+        }
+        view.close();
+        std::ifstream flat_in("out_flat.oct", std::ios::binary);
+        std::stringstream flat_corrupt;
+        flat_corrupt << flat_in.rdbuf();
+        flat_in.close();
+        std::remove("out_flat.oct");
+        std::string flat_bytes = flat_corrupt.str();
+        mi::flat_header flat_head;
+        std::memcpy( &flat_head, flat_bytes.data(), sizeof(flat_head) );
+        flat_head.level = 32;
+        std::memcpy( &flat_bytes[0], &flat_head, sizeof(flat_head) );
+        if ( view.attach( flat_bytes.data(), flat_bytes.size() ) ) {
+                std::cerr<<"Error at mi::octree_view<int>::attach() (level out of range)"<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::write_compressed()
+        std::ofstream packed("out_packed.oct", std::ios::binary);
+        tree3.write_compressed(packed);
+        packed.close();
+        mi::octree<int> tree9;
+        std::ifstream packed_in("out_packed.oct", std::ios::binary);
+        if ( !tree9.read(packed_in) || tree9.get(1,3,4) != 10 || tree9.get(100,200,300) != 3 || tree9.get(1,0,4) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::write_compressed() "<<tree9.get(1,3,4)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        packed_in.close();
+        std::remove("out_packed.oct");
+        //test octree::fill_box() and octree::for_each_in_box()
+        mi::octree<int> tree10(1024, 0);
+        tree10.fill_box(0, 0, 0, 511, 511, 511, 2);
+        tree10.fill_box(510, 510, 510, 512, 512, 512, 5);
+        if ( tree10.get(0,0,0) != 2 || tree10.get(509,511,511) != 2 || tree10.get(511,511,511) != 5 || tree10.get(512,512,512) != 5 || tree10.get(513,512,512) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::fill_box() "<<tree10.get(511,511,511)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        size_t filled = 0;
+        tree10.for_each_in_box(0, 0, 0, 1023, 1023, 1023, [&filled] ( int, int, int, int size, int value ) {
+                if ( value == 5 ) filled += static_cast<size_t>(size) * size * size;
+        });
+        if ( filled != 27 ) {
+                std::cerr<<"Error at mi::octree<int>::for_each_in_box() "<<filled<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::leaf_iterator and octree::parallel_for_each_leaf()
+        size_t voxels = 0;
+        size_t leaves = 0;
+        for ( mi::octree<int>::leaf_iterator it = tree10.leaf_begin(true) ; it != tree10.leaf_end() ; ++it ) {
+                voxels += static_cast<size_t>(it->size) * it->size * it->size;
+                ++leaves;
+        }
+        std::atomic<size_t> parallel_voxels(0);
+        tree10.parallel_for_each_leaf([&parallel_voxels] ( const mi::octree<int>::leaf& l ) {
+                parallel_voxels += static_cast<size_t>(l.size) * l.size * l.size;
+        }, true, 4);
+        if ( voxels != 512 * 512 * 512 + 27 - 8 || parallel_voxels != voxels ) {
+                std::cerr<<"Error at mi::octree<int>::leaf_iterator "<<voxels<<" "<<parallel_voxels<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::accessor
+        mi::octree<int>::accessor acc(tree10);
+        size_t swept = 0;
+        for ( int x = 500 ; x < 520 ; ++x ) swept += acc.get(x, 511, 511);
+        tree10.fill_box(0, 0, 0, 1023, 1023, 1023, 1);
+        if ( swept != 10 * 2 + 3 * 5 || acc.get(511, 511, 511) != 1 || acc.get(1024, 0, 0) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::accessor::get() "<<swept<<std::endl;
+                return EXIT_FAILURE;
+        }
+        mi::octree<int, mi::pool_allocator, mi::subtree_statistics> tree25(64, 0);
+        mi::octree<int, mi::pool_allocator, mi::subtree_statistics>::accessor acc25(tree25);
+        for ( int x = 0 ; x < 64 ; ++x ) acc25.set(x, 5, 7, 1 + x % 3);
+        std::shared_ptr<const mi::octree<int, mi::pool_allocator, mi::subtree_statistics> > snap25 = tree25.snapshot();
+        for ( int x = 0 ; x < 64 ; ++x ) acc25.set(x, 5, 7, 4);
+        acc25.set(64, 5, 7, 4);
+        if ( tree25.count(4) != 64 || tree25.count(0) != 64 * 64 * 64 - 64 || acc25.get(10, 5, 7) != 4 || tree25.get(63, 5, 7) != 4 ||
+             snap25->count(1) != 22 || snap25->get(10, 5, 7) != 2 || snap25->get(63, 5, 7) != 1 ) {
+                std::cerr<<"Error at mi::octree<int>::accessor::set() "<<tree25.count(4)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        snap25.reset();
+        //test octree::raycast()
+        mi::octree<int> tree14(64, 0);
+        tree14.fill_box(10, 10, 10, 20, 20, 20, 3);
+        mi::octree<int>::ray_hit hit;
+        if ( !tree14.raycast(-5.0, 15.5, 15.5, 1.0, 0.0, 0.0, 100.0, hit) || hit.x != 10 || hit.y != 15 || hit.z != 15 || hit.t != 15.0 || hit.value != 3 ||
+             tree14.raycast(-5.0, 15.5, 15.5, 1.0, 0.0, 0.0, 14.0, hit) || tree14.raycast(-5.0, 30.5, 15.5, 1.0, 0.0, 0.0, 100.0, hit) ) {
+                std::cerr<<"Error at mi::octree<int>::raycast() "<<hit.x<<" "<<hit.t<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::nearest() and octree::radius_query()
+        mi::octree<int>::voxel closest;
+        std::vector<mi::octree<int>::voxel> around;
+        if ( !tree14.nearest(0, 15, 15, closest) || closest.x != 10 || closest.y != 15 || closest.z != 15 || closest.value != 3 ||
+             tree14.radius_query(9, 15, 15, 1.0, around) != 1 || tree14.radius_query(9, 15, 15, 0.5, around) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::nearest() "<<closest.x<<" "<<around.size()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree_grid
+        mi::octree_grid<int> tree15(200, 100, 10, 0);
+        tree15.set(150, 20, 3, 6);
+        tree15.fill_box(10, 90, 5, 12, 200, 200, 2);
+        int gnx, gny, gnz, gxx, gxy, gxz;
+        tree15.boundingbox(gnx, gny, gnz, gxx, gxy, gxz);
+        if ( tree15.depth() != 4 || tree15.roots() != 3 || !tree15.is_valid(199, 99, 9) || tree15.is_valid(0, 100, 0) ||
+             tree15.get(150, 20, 3) != 6 || tree15.count(2) != 3 * 10 * 5 ||
+             gnx != 10 || gny != 20 || gnz != 3 || gxx != 150 || gxy != 99 || gxz != 9 ) {
+                std::cerr<<"Error at mi::octree_grid<int> "<<tree15.roots()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        mi::octree_grid<int> thin15(1024, 1024, 1, 0);
+        if ( thin15.getRootDimension() != 32 || mi::octree_grid<int>(1024, 1024, 1, 0, 4).getRootDimension() != 4 ) {
+                std::cerr<<"Error at mi::octree_grid<int>::getRootDimension() "<<thin15.getRootDimension()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::snapshot() (copy-on-write)
+        std::shared_ptr<const mi::octree<int> > snap14 = tree14.snapshot();
+        tree14.set(12, 12, 12, 9);
+        tree14.fill_box(0, 0, 0, 3, 3, 3, 5);
+        if ( snap14->get(12, 12, 12) != 3 || snap14->get(1, 1, 1) != 0 || tree14.get(12, 12, 12) != 9 || tree14.get(1, 1, 1) != 5 ||
+             snap14->get(20, 20, 20) != 3 || tree14.get(20, 20, 20) != 3 ) {
+                std::cerr<<"Error at mi::octree<int>::snapshot()"<<std::endl;
+                return EXIT_FAILURE;
+        }
+        snap14.reset();
+        //test octree::write_delta() and octree::apply_delta()
+        mi::octree<int> tree16(256, 0), tree17(256, 0);
+        tree16.set(3, 4, 5, 1);
+        tree17.set(3, 4, 5, 1);
+        tree16.track_changes();
+        tree16.set(200, 100, 50, 7);
+        tree16.fill_box(0, 0, 0, 20, 20, 20, 2);
+        std::stringstream delta;
+        if ( !tree16.write_delta(delta) || !tree17.apply_delta(delta) ||
+             tree17.get(200, 100, 50) != 7 || tree17.get(3, 4, 5) != 2 || tree17.get(21, 0, 0) != 0 || tree17.get(30, 30, 30) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::apply_delta() "<<tree17.get(200, 100, 50)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test move and octree::clear()
+        static_assert( std::is_nothrow_move_constructible< mi::octree<int> >::value, "octree moves must not throw" );
+        std::vector< mi::octree<int, mi::pool_allocator> > trees;
+        for ( int i = 0 ; i < 4 ; ++i ) {
+                trees.push_back( mi::octree<int, mi::pool_allocator>(64, 0) );
+                trees.back().set(i, i, i, i + 1);
+        }
+        mi::octree<int, mi::pool_allocator> tree18( std::move( trees[2] ) );
+        const size_t chunks18 = tree18.get_allocator().chunks();
+        tree18.clear(5);
+        tree18.set(1, 1, 1, 1);
+        if ( trees[3].get(3, 3, 3) != 4 || trees[2].getDimension() != 0 || tree18.get(2, 2, 2) != 5 || tree18.get(1, 1, 1) != 1 ||
+             tree18.get_allocator().chunks() != chunks18 || tree18.get_allocator().live_blocks() != 6 ) {
+                std::cerr<<"Error at mi::octree<int>::clear() "<<tree18.get_allocator().live_blocks()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        trees[2].set(1, 1, 1, 1);
+        trees[2].init(8, 3);
+        if ( trees[2].get_allocator().live_blocks() != 0 || trees[2].get(1, 1, 1) != 3 || trees[2].snapshot()->get(1, 1, 1) != 3 ) {
+                std::cerr<<"Error at mi::octree<int>::init() after move "<<trees[2].get(1, 1, 1)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::combine()
+        mi::octree<int> tree19(64, 0), tree20(64, 0), tree21;
+        tree19.fill_box(0, 0, 0, 31, 31, 31, 1);
+        tree20.fill_box(16, 16, 16, 47, 47, 47, 2);
+        tree21.combine(tree19, tree20, mi::octree<int>::INTERSECTION);
+        tree19.combine(tree19, tree20, mi::octree<int>::UNION);
+        tree20.combine(tree19, tree20, [] ( const int& a, const int& b ) { return a + b; });
+        if ( tree21.get(20, 20, 20) != 1 || tree21.get(10, 10, 10) != 0 || tree21.get(40, 40, 40) != 0 ||
+             tree19.get(10, 10, 10) != 1 || tree19.get(20, 20, 20) != 1 || tree19.get(40, 40, 40) != 2 || tree19.get(50, 50, 50) != 0 ||
+             tree20.get(10, 10, 10) != 1 || tree20.get(20, 20, 20) != 3 || tree20.get(40, 40, 40) != 4 ) {
+                std::cerr<<"Error at mi::octree<int>::combine() "<<tree20.get(20, 20, 20)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test octree::get_at_level() (mean of child nodes)
+        mi::octree<int> tree22(64, 0);
+        tree22.fill_box(0, 0, 0, 15, 15, 15, 8);
+        tree22.enable_lod( &mi::octree<int>::lod_mean );
+        tree22.set(40, 40, 40, 64);
+        if ( tree22.get_at_level(40, 40, 40, 0) != 64 || tree22.get_at_level(41, 41, 41, 1) != 8 || tree22.get_at_level(40, 40, 40, 2) != 1 ||
+             tree22.get_at_level(40, 40, 40, 3) != 0 || tree22.get_at_level(31, 31, 31, 5) != 1 || tree22.get_at_level(5, 5, 5, 3) != 8 ) {
+                std::cerr<<"Error at mi::octree<int>::get_at_level() "<<tree22.get_at_level(41, 41, 41, 1)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        tree22.update_lod();
+        if ( tree22.get_at_level(41, 41, 41, 1) != 8 || tree22.get_at_level(40, 40, 40, 2) != 1 ) {
+                std::cerr<<"Error at mi::octree<int>::update_lod() "<<tree22.get_at_level(41, 41, 41, 1)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        mi::octree<int>::accessor acc22(tree22);
+        acc22.set(40, 40, 40, 0);
+        if ( tree22.get_at_level(41, 41, 41, 1) != 0 || tree22.get_at_level(40, 40, 40, 2) != 0 ) {
+                std::cerr<<"Error at mi::octree<int>::accessor::set() (stale LOD values) "<<tree22.get_at_level(41, 41, 41, 1)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        tree22.set(40, 40, 40, 64);
+        std::shared_ptr<const mi::octree<int> > snap22 = tree22.snapshot();
+        const int stored22 = tree22.get_at_level(41, 41, 41, 1);
+        tree22.set(41, 40, 40, 64);
+        if ( stored22 != 8 || tree22.get_at_level(41, 41, 41, 1) != 16 || tree22.get_at_level(40, 40, 40, 2) != 2 ||
+             snap22->get_at_level(41, 41, 41, 1) != 8 || snap22->get_at_level(40, 40, 40, 2) != 1 ) {
+                std::cerr<<"Error at mi::octree<int>::get_at_level() (stored LOD values) "<<tree22.get_at_level(41, 41, 41, 1)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        snap22.reset();
+        //test octree::get_profile()
+        mi::octree<int> tree23(4, 0);
+        tree23.set(0, 0, 0, 1);
+        const mi::octree<int>::profile profile23 = tree23.get_profile();
+        if ( profile23.nodes != 17 || profile23.leaves != 15 || profile23.depth[0] != 0 || profile23.depth[1] != 7 || profile23.depth[2] != 8 ) {
+                std::cerr<<"Error at mi::octree<int>::get_profile() "<<profile23.nodes<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test linear_octree
+        mi::octree<int> tree24(64, 0);
+        tree24.fill_box(0, 0, 0, 15, 15, 15, 2);
+        tree24.set(40, 50, 60, 9);
+        mi::linear_octree<int> linear24(tree24);
+        linear24.build_index(2);
+        linear24.boundingbox(mnx, mny, mnz, mxx, mxy, mxz);
+        if ( linear24.size() != 2 || linear24.get(5, 6, 7) != 2 || linear24.get(40, 50, 60) != 9 || linear24.get(40, 50, 61) != 0 ||
+             linear24.count(2) != 4096 || linear24.count(0) != 64 * 64 * 64 - 4097 || mxx != 40 || mxy != 50 || mxz != 60 ) {
+                std::cerr<<"Error at mi::linear_octree<int>::get() "<<linear24.get(40, 50, 60)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        mi::linear_octree<int> linear25;
+        std::ifstream fin25("out.oct", std::ios::binary);
+        if ( !linear25.read(fin25) || linear25.size() != 1 || linear25.get(1, 3, 4) != 10 || linear25.get(1, 0, 4) != 0 ) {
+                std::cerr<<"Error at mi::linear_octree<int>::read() "<<linear25.get(1, 3, 4)<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test concurrent_octree (threads share every split)
+        mi::concurrent_octree<int> tree11(64, 0);
+        std::vector<std::thread> writers;
+        for ( int t = 0 ; t < 8 ; ++t ) {
+                writers.push_back( std::thread( [&tree11, t] ( void ) {
+                        for ( int z = 0 ; z < 64 ; ++z ) {
+                                for ( int y = 0 ; y < 64 ; ++y ) {
+                                        for ( int x = t ; x < 64 ; x += 8 ) {
+                                                tree11.set(x, y, z, 1 + ( x + y + z ) % 5);
+                                                if ( tree11.get(x, y, z) != 1 + ( x + y + z ) % 5 ) tree11.set(0, 0, 0, -1);
+                                        }
+                                }
+                        }
+                } ) );
+        }
+        for ( size_t i = 0 ; i < writers.size() ; ++i ) writers[i].join();
+        bool concurrent_ok = ( tree11.blocks() == 1 + 8 + 64 + 512 + 4096 + 32768 );
+        for ( int z = 0 ; z < 64 && concurrent_ok ; ++z ) {
+                for ( int y = 0 ; y < 64 ; ++y ) {
+                        for ( int x = 0 ; x < 64 ; ++x ) {
+                                if ( tree11.get(x, y, z) != 1 + ( x + y + z ) % 5 ) concurrent_ok = false;
+                        }
+                }
+        }
+        mi::octree<int> tree12;
+        tree11.copy_to(tree12);
+        if ( !concurrent_ok || tree12.get(3, 5, 7) != 1 + 15 % 5 || tree12.count(0) != 0 ) {
+                std::cerr<<"Error at mi::concurrent_octree<int>::set() "<<tree11.blocks()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        //test brick_octree
+        mi::brick_octree<int> tree13(100, 0);
+        tree13.set(1, 3, 4, 10);
+        tree13.fill_box(8, 8, 8, 15, 15, 15, 7);
+        tree13.fill_box(8, 8, 8, 9, 15, 15, 2);
+        int bmn, bmx;
+        tree13.value_range(bmn, bmx);
+        if ( tree13.getDimension() != 128 || tree13.get(1, 3, 4) != 10 || tree13.get(9, 9, 9) != 2 || tree13.get(10, 9, 9) != 7 ||
+             tree13.count(7) != 6 * 8 * 8 || tree13.count_nonempty() != 8 * 8 * 8 + 1 || tree13.bricks() != 2 || bmn != 0 || bmx != 10 ) {
+                std::cerr<<"Error at mi::brick_octree<int> "<<tree13.count_nonempty()<<std::endl;
+                return EXIT_FAILURE;
+        }
+        tree13.set(1, 3, 4, 0);
+        tree13.fill_box(8, 8, 8, 15, 15, 15, 0);
+        if ( tree13.bricks() != 0 || tree13.count_nonempty() != 0 ) {
+                std::cerr<<"Error at mi::brick_octree<int> (uniform bricks are not collapsed) "<<tree13.bricks()<<std::endl;
+                return EXIT_FAILURE;
+        }
         std::cerr<<"OK"<<std::endl;
         return EXIT_SUCCESS;
 }
@@ -0,0 +1,289 @@
+/*
+
+Copyright (c) 2009, Takashi Michikawa
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of RCAST, The University of Tokyo nor the names of its
+contributors may be used to endorse or promote products derived from
+this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+/**
+* @file octree_view.hpp
+* @brief
+* "octree_view" is a read-only octree which is queried in place from a file
+* written by octree::write_flat(). The file is mapped with mmap(), so
+* opening a view does not read or allocate nodes.
+*
+* @note This code is distributed under BSD license.
+*/
+#ifndef __OCTREE_VIEW_HPP__
+#define __OCTREE_VIEW_HPP__ 1
+#include "octree.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace mi
+{
+        /**
+        * @class octree_view
+        * octree_view gives read-only access to a flat octree file.
+        * @section ex Example code
+        * @code
+        * mi::octree<int> tree(1024, 0);
+        * tree.set(100, 200, 300, 4);
+        * std::ofstream fout("tree.oct", std::ios::binary);
+        * tree.write_flat(fout);
+        * fout.close();
+        *
+        * mi::octree_view<int> view("tree.oct");
+        * int value = view.get(100, 200, 300); // value = 4;
+        * @endcode
+        * @note The file must be written on a machine with the same byte order,
+        * and it is trusted (child offsets are not checked on every query).
+        */
+        template < typename T >
+        class octree_view
+        {
+        private:
+                typedef flat_record<T> record;
+
+                const record*   _records;    ///< Node records (the root is _records[0]).
+                size_t          _size;       ///< The number of node records.
+                int             _dimension;  ///< Size of the octree.
+                unsigned char   _level;      ///< Maximum level of the octree.
+                T               _emptyValue; ///< Empty value of the octree.
+                void*           _map;        ///< Mapped address (NULL if the view does not own a mapping).
+                size_t          _mapSize;    ///< Size of the mapping.
+        private:
+                octree_view ( const octree_view& that );
+                void operator = ( const octree_view& that );
+        public:
+                /**
+                * @brief Default constructor.
+                */
+                octree_view ( void ) : _records(NULL), _size(0), _dimension(0), _level(0), _emptyValue(), _map(NULL), _mapSize(0) {
+                        return;
+                }
+
+                /**
+                * @param[in] filename file written by octree::write_flat()
+                */
+                explicit octree_view ( const char* filename ) : _records(NULL), _size(0), _dimension(0), _level(0), _emptyValue(), _map(NULL), _mapSize(0) {
+                        this->open(filename);
+                        return;
+                }
+
+                /**
+                * @brief Destructor
+                */
+                ~octree_view ( void ) {
+                        this->close();
+                        return;
+                }
+
+                /**
+                * @brief map a file.
+                * @param[in] filename file written by octree::write_flat()
+                * @retval true Succeeded.
+                * @retval false Failed.
+                */
+                bool open ( const char* filename ) {
+                        this->close();
+                        const int fd = ::open( filename, O_RDONLY );
+                        if ( fd < 0 ) return false;
+                        struct stat st;
+                        if ( ::fstat( fd, &st ) != 0 || st.st_size <= 0 ) {
+                                ::close( fd );
+                                return false;
+                        }
+                        void* map = ::mmap( NULL, static_cast<size_t>( st.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+                        ::close( fd );
+                        if ( map == MAP_FAILED ) return false;
+                        if ( !this->attach( map, static_cast<size_t>( st.st_size ) ) ) {
+                                ::munmap( map, static_cast<size_t>( st.st_size ) );
+                                return false;
+                        }
+                        this->_map = map;
+                        this->_mapSize = static_cast<size_t>( st.st_size );
+                        return true;
+                }
+
+                /**
+                * @brief use a flat octree already in memory (not copied).
+                * @param[in] data the image of the file. It must be aligned for T and outlive the view.
+                * @param[in] size size of data in bytes
+                * @retval true Succeeded.
+                * @retval false Failed (not a flat octree of T).
+                */
+                bool attach ( const void* data, const size_t size ) {
+                        this->close();
+                        if ( size < sizeof(flat_header) + sizeof(record) ) return false;
+                        flat_header header;
+                        std::memcpy( &header, data, sizeof(header) );
+                        if ( std::memcmp( header.magic, "MIOCTREE", 8 ) != 0 ) return false;
+                        if ( header.byte_order != flat_header::ENDIAN_MARK ) return false;
+                        if ( header.version != flat_header::VERSION ) return false;
+                        if ( header.value_size != sizeof(T) || header.record_size != sizeof(record) ) return false;
+                        if ( header.records == 0 || ( size - sizeof(flat_header) ) / sizeof(record) < header.records + 1 ) return false;
+                        if ( header.level > octree<T>::MAX_LEVEL ) return false;
+
+                        const record* r = reinterpret_cast<const record*>( static_cast<const char*>(data) + sizeof(flat_header) );
+                        this->_emptyValue = r[0].value;
+                        this->_records    = r + 1;
+                        this->_size       = static_cast<size_t>( header.records );
+                        this->_dimension  = header.dimension;
+                        this->_level      = static_cast<unsigned char>( header.level );
+                        return true;
+                }
+
+                /**
+                * @brief unmap the file.
+                */
+                void close ( void ) {
+                        if ( this->_map != NULL ) ::munmap( this->_map, this->_mapSize );
+                        this->_map = NULL;
+                        this->_mapSize = 0;
+                        this->_records = NULL;
+                        this->_size = 0;
+                        this->_dimension = 0;
+                        return;
+                }
+
+                /**
+                * @retval true A file is mapped or attached.
+                * @retval false Nothing is mapped.
+                */
+                bool is_open ( void ) const {
+                        return this->_records != NULL;
+                }
+
+                /**
+                * @brief get value at (x, y, z)
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @return the value at (x, y, z) or empty value if (x, y, z) is invalid.
+                */
+                T get ( const int x, const int y, const int z ) const {
+                        if ( !this->is_valid(x, y, z) ) return this->_emptyValue;
+                        const record* r = this->_records;
+                        unsigned char l = this->_level;
+                        while ( r->child != 0 ) {
+                                --l;
+                                r += r->child + ( ( ( x >> l ) & 1 ) | ( ( ( y >> l ) & 1 ) << 1 ) | ( ( ( z >> l ) & 1 ) << 2 ) );
+                        }
+                        return r->value;
+                }
+
+                /**
+                * @brief check (x, y, z) is valid
+                * @param[in] x x-coordinate
+                * @param[in] y y-coordinate
+                * @param[in] z z-coordinate
+                * @retval true (x, y, z) is valid
+                * @retval false (x, y, z) is invalid
+                */
+                bool is_valid ( const int x, const int y, const int z ) const {
+                        if ( this->_records == NULL ) return false;
+                        if ( x < 0 || y < 0 || z < 0 ) return false;
+                        if ( this->_dimension <= x || this->_dimension <= y || this->_dimension <= z ) return false;
+                        return true;
+                }
+
+                /**
+                * @brief get bounding box (mnx, mny, mnz) - (mxx, mxy, mxz)
+                * @param[out] mnx minimum x-coordinate
+                * @param[out] mny minimum y-coordinate
+                * @param[out] mnz minimum z-coordinate
+                * @param[out] mxx maximum x-coordinate
+                * @param[out] mxy maximum y-coordinate
+                * @param[out] mxz maximum z-coordinate
+                * @param[in] optimized if true, get bounding box of non-empty cells
+                */
+                void boundingbox ( int& mnx, int& mny, int& mnz, int& mxx, int& mxy, int& mxz, bool optimized = true ) const {
+                        if ( optimized && this->_records != NULL ) {
+                                this->boundingbox( this->_records, this->_level, mnx, mny, mnz, mxx, mxy, mxz );
+                        } else {
+                                mnx = mny = mnz = 0;
+                                mxx = mxy = mxz = this->_dimension - 1;
+                        }
+                        return;
+                }
+
+                /**
+                * @return a dimension of the octree. It must be a 2^n.
+                */
+                int getDimension ( void ) const {
+                        return this->_dimension;
+                }
+
+                /**
+                * @return empty value of the octree.
+                */
+                T getEmptyValue ( void ) const {
+                        return this->_emptyValue;
+                }
+
+                /**
+                * @return the number of node records.
+                */
+                size_t size ( void ) const {
+                        return this->_size;
+                }
+        private:
+                bool boundingbox ( const record* r, const unsigned char level,
+                                   int& mnx, int& mny, int& mnz,
+                                   int& mxx, int& mxy, int& mxz ) const {
+                        const int d = 1 << level;
+                        mnx = mny = mnz = d - 1;
+                        mxx = mxy = mxz = 0;
+                        if ( r->child == 0 ) {
+                                if ( r->value != this->_emptyValue ) {
+                                        mnx = mny = mnz = 0;
+                                        mxx = mxy = mxz = d - 1;
+                                        return true;
+                                }
+                                return false;
+                        }
+                        for ( int id = 0 ; id < 8 ; ++id ) {
+                                int lnx, lny, lnz, lxx, lxy, lxz;
+                                if ( !this->boundingbox( r + r->child + id, level - 1, lnx, lny, lnz, lxx, lxy, lxz ) ) continue;
+                                const int offx = d / 2 * ( id & 1 );
+                                const int offy = d / 2 * ( ( id >> 1 ) & 1 );
+                                const int offz = d / 2 * ( ( id >> 2 ) & 1 );
+                                if ( lnx + offx < mnx ) mnx = lnx + offx;
+                                if ( lny + offy < mny ) mny = lny + offy;
+                                if ( lnz + offz < mnz ) mnz = lnz + offz;
+                                if ( lxx + offx > mxx ) mxx = lxx + offx;
+                                if ( lxy + offy > mxy ) mxy = lxy + offy;
+                                if ( lxz + offz > mxz ) mxz = lxz + offz;
+                        }
+                        return mnx <= mxx && mny <= mxy && mnz <= mxz;
+                }
+        };
+};
+#endif// __OCTREE_VIEW_HPP__